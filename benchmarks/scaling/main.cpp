@@ -0,0 +1,248 @@
+
+// Copyright (c) 2013-2020 niXman (i dotty nixman doggy gmail dotty com)
+// All rights reserved.
+//
+// This file is part of YAL(https://github.com/niXman/yal) project.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//   Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+//   Redistributions in binary form must reproduce the above copyright notice, this
+//   list of conditions and the following disclaimer in the documentation and/or
+//   other materials provided with the distribution.
+//
+//   Neither the name of the {organization} nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// measures the throughput and the latency distribution of YAL_LOG_* calls made by
+// 1..N threads into one session and into a session per thread, and with a slow disk
+// simulated by a throttled io. prints the results in JSON.
+//
+// usage: scaling [max-threads] [records-per-thread] [logs-root-path]
+
+#include <yal/yal.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/***************************************************************************/
+
+// keeps the write rate of the wrapped io at 'bytes_per_sec', like a slow disk
+struct throttled_io: yal::io_base {
+    throttled_io(yal::io_base *io, std::size_t bytes_per_sec)
+        :m_io(io)
+        ,m_rate(bytes_per_sec)
+        ,m_start(clock::now())
+        ,m_written(0)
+    {}
+
+    void create(const std::string &fname) { m_io->create(fname); }
+    void write(const void *ptr, const std::size_t size) {
+        m_io->write(ptr, size);
+        m_written += size;
+
+        // sleeps only when it's ahead by a millisecond, the short sleeps are too inaccurate
+        const auto due = m_start + std::chrono::microseconds(m_written * 1000000 / m_rate);
+        if ( due - clock::now() > std::chrono::milliseconds(1) ) {
+            std::this_thread::sleep_until(due);
+        }
+    }
+    void close() { m_io->close(); }
+    void fsync() { m_io->fsync(); }
+    std::size_t fpos() { return m_io->fpos(); }
+    std::string name() const { return m_io->name(); }
+    bool rename(const std::string &fname) { return m_io->rename(fname); }
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    std::unique_ptr<yal::io_base> m_io;
+    const std::size_t m_rate;
+    const clock::time_point m_start;
+    std::uint64_t m_written;
+};
+
+/***************************************************************************/
+
+struct scenario {
+    const char *name;
+    std::uint32_t opts;
+    bool session_per_thread;
+    std::size_t disk_rate; // bytes per second, zero if not throttled
+    yal::overflow_policy overflow;
+};
+
+struct result {
+    std::string   scenario;
+    std::size_t   threads;
+    std::size_t   sessions;
+    std::size_t   records; // logged, including the dropped ones
+    double        secs;
+    std::uint64_t dropped;
+    std::vector<std::uint64_t> latency; // sorted, in nanoseconds
+};
+
+static result run(const scenario &sc, std::size_t threads, std::size_t records) {
+    using clock = std::chrono::steady_clock;
+
+    yal::io_factory io;
+    if ( sc.disk_rate ) {
+        const std::size_t rate = sc.disk_rate;
+        io = [rate](std::uint32_t opts) { return new throttled_io(yal::io_base::create_default(opts), rate); };
+    }
+
+    std::vector<yal::session> sessions;
+    for ( std::size_t idx = 0; idx < (sc.session_per_thread ? threads : 1); ++idx ) {
+        const std::string name = std::string("scaling/") + sc.name + "-" + std::to_string(threads) + "-" + std::to_string(idx);
+        sessions.push_back(yal::logger::create(name, 256*1024*1024, sc.opts, yal::detail::process_buffer(), io));
+        sessions.back()->overflow(sc.overflow);
+    }
+
+    std::vector<std::vector<std::uint64_t>> latency(threads);
+    std::atomic<std::size_t> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> workers;
+    for ( std::size_t idx = 0; idx < threads; ++idx ) {
+        workers.emplace_back(
+            [&, idx]() {
+                const yal::session &log = sessions[sc.session_per_thread ? idx : 0];
+                std::vector<std::uint64_t> &lat = latency[idx];
+                lat.reserve(records);
+
+                ++ready;
+                while ( !go.load() )
+                    std::this_thread::yield();
+
+                for ( std::size_t rec = 0; rec < records; ++rec ) {
+                    const auto start = clock::now();
+                    YAL_LOG_INFO(log, "thread {} record {}", idx, rec);
+                    lat.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
+                }
+            }
+        );
+    }
+
+    while ( ready.load() != threads )
+        std::this_thread::yield();
+    const auto start = clock::now();
+    go = true;
+    for ( auto &it: workers ) {
+        it.join();
+    }
+    for ( const auto &it: sessions ) {
+        it->flush();
+    }
+    const double secs = std::chrono::duration<double>(clock::now() - start).count();
+
+    result res{sc.name, threads, sessions.size(), threads * records, secs, 0, {}};
+    for ( const auto &it: sessions ) {
+        res.dropped += it->dropped_records();
+    }
+    for ( const auto &it: latency ) {
+        res.latency.insert(res.latency.end(), it.begin(), it.end());
+    }
+    std::sort(res.latency.begin(), res.latency.end());
+
+    return res;
+}
+
+static std::uint64_t percentile(const std::vector<std::uint64_t> &sorted, double q) {
+    if ( sorted.empty() )
+        return 0;
+
+    const std::size_t idx = static_cast<std::size_t>(q * static_cast<double>(sorted.size()-1) + 0.5);
+    return sorted[idx];
+}
+
+static void print(std::ostream &os, const std::vector<result> &results) {
+    os << "{\n  \"benchmark\": \"scaling\",\n  \"results\": [\n";
+    for ( std::size_t idx = 0; idx < results.size(); ++idx ) {
+        const result &r = results[idx];
+        os << fmt::format(
+             "    {{\"scenario\": \"{}\", \"threads\": {}, \"sessions\": {}, \"records\": {}, \"seconds\": {:.6f}"
+             ", \"records_per_sec\": {:.0f}, \"written\": {}, \"dropped\": {}"
+             ", \"latency_ns\": {{\"p50\": {}, \"p99\": {}, \"p99.9\": {}, \"max\": {}}}}}{}\n"
+            ,r.scenario
+            ,r.threads
+            ,r.sessions
+            ,r.records
+            ,r.secs
+            ,(r.records - r.dropped) / r.secs
+            ,r.records - r.dropped
+            ,r.dropped
+            ,percentile(r.latency, 0.5)
+            ,percentile(r.latency, 0.99)
+            ,percentile(r.latency, 0.999)
+            ,r.latency.empty() ? 0 : r.latency.back()
+            ,(idx+1 < results.size() ? "," : "")
+        );
+    }
+    os << "  ]\n}" << std::endl;
+}
+
+/***************************************************************************/
+
+int main(int argc, char **argv) {
+    const std::size_t max_threads = argc > 1
+        ? std::strtoul(argv[1], nullptr, 10)
+        : std::max<std::size_t>(std::thread::hardware_concurrency(), 1)
+    ;
+    const std::size_t records = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 50000;
+    YAL_SET_ROOT_PATH(argc > 3 ? argv[3] : "scaling-logs");
+
+    // the slow disk scenarios write fewer records, the disk is ~4MB/s
+    const std::size_t slow_rate = 4*1024*1024;
+    const std::size_t slow_records = std::max<std::size_t>(records / 10, 1);
+    const scenario scenarios[] = {
+         {"one_session", yal::usec_res, false, 0, yal::overflow_block}
+        ,{"one_session_per_thread_buffers", yal::usec_res|yal::per_thread_buffers, false, 0, yal::overflow_block}
+        ,{"session_per_thread", yal::usec_res, true, 0, yal::overflow_block}
+        ,{"slow_disk_block", yal::usec_res, false, slow_rate, yal::overflow_block}
+        ,{"slow_disk_drop_newest", yal::usec_res, false, slow_rate, yal::overflow_drop_newest}
+    };
+
+    // the powers of two, and 'max_threads'
+    std::vector<std::size_t> thread_counts;
+    for ( std::size_t threads = 1; threads < max_threads; threads *= 2 ) {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(std::max<std::size_t>(max_threads, 1));
+
+    std::vector<result> results;
+    try {
+        for ( const auto &sc: scenarios ) {
+            for ( const auto threads: thread_counts ) {
+                results.push_back(run(sc, threads, sc.disk_rate ? slow_records : records));
+            }
+        }
+    } catch (const std::exception &ex) {
+        std::cerr << "[std::exception]: " << ex.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    print(std::cout, results);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,36 @@
+
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG -= qt
+
+QMAKE_CXXFLAGS += \
+    -std=c++11 \
+    -Wall \
+    -Wextra \
+    -O2
+
+#DEFINES += \
+#    YAL_DISABLE_LOGGING
+
+INCLUDEPATH += \
+    ../../include
+
+LIBS += \
+    -lz \
+    -lpthread
+
+SOURCES += \
+    main.cpp \
+    ../../src/yal.cpp \
+    ../../src/index.cpp \
+    ../../src/summary.cpp
+
+HEADERS += \
+    ../../include/yal/yal.hpp \
+    ../../include/yal/options.hpp \
+    ../../include/yal/throw.hpp \
+    ../../include/yal/files.hpp \
+    ../../include/yal/index.hpp \
+    ../../include/yal/summary.hpp \
+    ../../include/yal/dtf.hpp
@@ -0,0 +1,201 @@
+
+// Copyright (c) 2013-2020 niXman (i dotty nixman doggy gmail dotty com)
+// All rights reserved.
+//
+// This file is part of YAL(https://github.com/niXman/yal) project.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//   Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+//   Redistributions in binary form must reproduce the above copyright notice, this
+//   list of conditions and the following disclaimer in the documentation and/or
+//   other materials provided with the distribution.
+//
+//   Neither the name of the {organization} nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// measures the throughput of YAL_LOG_* for the session options, the message sizes
+// and the argument types. prints the results in JSON.
+//
+// usage: throughput [records] [logs-root-path]
+
+#include <yal/yal.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/***************************************************************************/
+
+struct result {
+    std::string   name;
+    std::uint32_t opts;
+    std::size_t   records;
+    double        call_secs;  // of the log calls only
+    double        total_secs; // including the flush
+    std::uint64_t bytes;      // of the formatted records
+};
+
+static std::string options_str(std::uint32_t opts) {
+    static const std::pair<std::uint32_t, const char*> names[] = {
+         {yal::sec_res, "sec_res"}
+        ,{yal::msec_res, "msec_res"}
+        ,{yal::usec_res, "usec_res"}
+        ,{yal::nsec_res, "nsec_res"}
+        ,{yal::fsync_each_record, "fsync_each_record"}
+        ,{yal::compress, "compress"}
+        ,{yal::full_source_name, "full_source_name"}
+        ,{yal::full_func_name, "full_func_name"}
+        ,{yal::create_index_file, "create_index_file"}
+        ,{yal::per_thread_buffers, "per_thread_buffers"}
+    };
+
+    std::string res;
+    for ( const auto &it: names ) {
+        if ( opts & it.first ) {
+            res += res.empty() ? "" : "|";
+            res += it.second;
+        }
+    }
+
+    return res;
+}
+
+// 'body' writes the record number 'idx' to 'log'
+static result run(
+     const std::string &name
+    ,std::uint32_t opts
+    ,std::size_t records
+    ,const std::function<void(const yal::session &, std::size_t)> &body)
+{
+    using clock = std::chrono::steady_clock;
+
+    yal::session log = yal::logger::create("throughput/"+name, 256*1024*1024, opts);
+
+    const auto start = clock::now();
+    for ( std::size_t idx = 0; idx < records; ++idx ) {
+        body(log, idx);
+    }
+    const auto called = clock::now();
+    log->flush();
+    const auto flushed = clock::now();
+
+    const yal::session_stats stats = log->stats();
+    log.reset();
+
+    return {
+         name
+        ,opts
+        ,records
+        ,std::chrono::duration<double>(called - start).count()
+        ,std::chrono::duration<double>(flushed - start).count()
+        ,stats.total_bytes()
+    };
+}
+
+static void print(std::ostream &os, const std::vector<result> &results) {
+    os << "{\n  \"benchmark\": \"throughput\",\n  \"results\": [\n";
+    for ( std::size_t idx = 0; idx < results.size(); ++idx ) {
+        const result &r = results[idx];
+        os << fmt::format(
+             "    {{\"name\": \"{}\", \"options\": \"{}\", \"records\": {}, \"seconds\": {:.6f}"
+             ", \"ns_per_call\": {:.1f}, \"records_per_sec\": {:.0f}, \"bytes_per_sec\": {:.0f}}}{}\n"
+            ,r.name
+            ,options_str(r.opts)
+            ,r.records
+            ,r.total_secs
+            ,r.call_secs * 1e9 / r.records
+            ,r.records / r.total_secs
+            ,r.bytes / r.total_secs
+            ,(idx+1 < results.size() ? "," : "")
+        );
+    }
+    os << "  ]\n}" << std::endl;
+}
+
+/***************************************************************************/
+
+int main(int argc, char **argv) {
+    const std::size_t records = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+    YAL_SET_ROOT_PATH(argc > 2 ? argv[2] : "throughput-logs");
+
+    // 'fsync_each_record' is orders of magnitude slower
+    const std::size_t fsync_records = std::max<std::size_t>(records / 100, 1);
+
+    std::vector<result> results;
+    try {
+        auto small = [](const yal::session &log, std::size_t idx) {
+            YAL_LOG_INFO(log, "record {}", idx);
+        };
+
+        // the session options, with a short message
+        const std::pair<const char*, std::uint32_t> options[] = {
+             {"sec_res", yal::sec_res}
+            ,{"msec_res", yal::msec_res}
+            ,{"usec_res", yal::usec_res}
+            ,{"nsec_res", yal::nsec_res}
+            ,{"compress", yal::usec_res|yal::compress}
+            ,{"create_index_file", yal::usec_res|yal::create_index_file}
+            ,{"full_func_name", yal::usec_res|yal::full_func_name}
+            ,{"full_source_name", yal::usec_res|yal::full_source_name}
+            ,{"per_thread_buffers", yal::usec_res|yal::per_thread_buffers}
+        };
+        for ( const auto &it: options ) {
+            results.push_back(run(it.first, it.second, records, small));
+        }
+        results.push_back(run("fsync_each_record", yal::usec_res|yal::fsync_each_record, fsync_records, small));
+
+        // the message sizes
+        for ( const std::size_t size: {16, 128, 1024, 4096} ) {
+            const std::string payload(size, 'x');
+            results.push_back(run(
+                 "message_size_"+std::to_string(size)
+                ,yal::usec_res
+                ,records
+                ,[&payload](const yal::session &log, std::size_t) { YAL_LOG_INFO(log, "{}", payload); }
+            ));
+        }
+
+        // the argument types
+        const std::string str("some string argument");
+        results.push_back(run("args_none", yal::usec_res, records,
+            [](const yal::session &log, std::size_t) { YAL_LOG_INFO(log, "a record without arguments"); }));
+        results.push_back(run("args_int", yal::usec_res, records,
+            [](const yal::session &log, std::size_t idx) { YAL_LOG_INFO(log, "{} {} {} {}", idx, idx+1, idx+2, idx+3); }));
+        results.push_back(run("args_double", yal::usec_res, records,
+            [](const yal::session &log, std::size_t idx) { YAL_LOG_INFO(log, "{} {:.3f}", idx * 0.5, idx / 3.0); }));
+        results.push_back(run("args_cstring", yal::usec_res, records,
+            [](const yal::session &log, std::size_t) { YAL_LOG_INFO(log, "{} {}", "some c-string", "argument"); }));
+        results.push_back(run("args_string", yal::usec_res, records,
+            [&str](const yal::session &log, std::size_t) { YAL_LOG_INFO(log, "{} {}", str, str); }));
+        results.push_back(run("args_mixed", yal::usec_res, records,
+            [&str](const yal::session &log, std::size_t idx) { YAL_LOG_INFO(log, "{} {} {:.2f} {}", idx, str, idx * 0.5, 'c'); }));
+    } catch (const std::exception &ex) {
+        std::cerr << "[std::exception]: " << ex.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    print(std::cout, results);
+
+    return EXIT_SUCCESS;
+}
@@ -16,16 +16,20 @@ INCLUDEPATH += \
     ../../include
 
 LIBS += \
-    -lz
+    -lz \
+    -lpthread
 
 SOURCES += \
     main.cpp \
     ../../src/yal.cpp \
-    ../../src/index.cpp
+    ../../src/index.cpp \
+    ../../src/summary.cpp
 
 HEADERS += \
     ../../include/yal/yal.hpp \
     ../../include/yal/options.hpp \
     ../../include/yal/throw.hpp \
+    ../../include/yal/files.hpp \
     ../../include/yal/index.hpp \
+    ../../include/yal/summary.hpp \
     ../../include/yal/dtf.hpp
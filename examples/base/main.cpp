@@ -30,9 +30,113 @@
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <iostream>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <map>
 #include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
 
 #include <yal/yal.hpp>
+#include <yal/summary.hpp>
+
+/***************************************************************************/
+
+// the names of the files in 'dir' starting with 'prefix'
+static std::vector<std::string> list_files(const std::string &dir, const std::string &prefix) {
+    std::vector<std::string> res;
+    if ( DIR *d = ::opendir(dir.c_str()) ) {
+        while ( struct dirent *it = ::readdir(d) ) {
+            if ( std::string(it->d_name).compare(0, prefix.size(), prefix) == 0 )
+                res.push_back(it->d_name);
+        }
+        ::closedir(d);
+    }
+
+    return res;
+}
+
+static bool has_file(const std::vector<std::string> &files, const std::string &prefix) {
+    for ( const auto &it: files ) {
+        if ( it.compare(0, prefix.size(), prefix) == 0 )
+            return true;
+    }
+
+    return false;
+}
+
+// the number of the lines in 'fname' containing 'text'
+static std::size_t count_lines(const std::string &fname, const std::string &text) {
+    std::size_t res = 0;
+    std::ifstream file(fname);
+    for ( std::string line; std::getline(file, line); ) {
+        res += line.find(text) != std::string::npos;
+    }
+
+    return res;
+}
+
+// the writes wait while the gate is closed, so the records stay in the session's buffer
+struct gate {
+    std::atomic<bool> closed{false};
+    std::atomic<bool> entered{false};
+
+    // the returned thread holds the sink of 'log' until the gate is opened
+    std::thread close(const yal::session &log) {
+        closed = true;
+        entered = false;
+        std::thread res([&log]() { YAL_LOG_INFO(log, "gate"); });
+        while ( !entered )
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+        return res;
+    }
+    void open(std::thread &holder) {
+        closed = false;
+        holder.join();
+    }
+};
+
+struct gated_io: yal::io_base {
+    gated_io(yal::io_base *io, gate *g)
+        :m_io(io)
+        ,m_gate(g)
+    {}
+
+    void create(const std::string &fname) { m_io->create(fname); }
+    void write(const void *ptr, const std::size_t size) {
+        if ( m_gate->closed ) {
+            m_gate->entered = true;
+            while ( m_gate->closed )
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        m_io->write(ptr, size);
+    }
+    void close() { m_io->close(); }
+    void fsync() { m_io->fsync(); }
+    std::size_t fpos() { return m_io->fpos(); }
+    std::string name() const { return m_io->name(); }
+    bool rename(const std::string &fname) { return m_io->rename(fname); }
+
+private:
+    std::unique_ptr<yal::io_base> m_io;
+    gate *m_gate;
+};
+
+static yal::io_factory gated(gate *g) {
+    return [g](std::uint32_t opts) { return new gated_io(yal::io_base::create_default(opts), g); };
+}
+
+// the volumes and their metadata are not readable by the others
+static bool owner_only(const std::string &fname) {
+    struct ::stat st{};
+    return ::stat(fname.c_str(), &st) == 0 && (st.st_mode & 0077) == 0;
+}
 
 /***************************************************************************/
 
@@ -44,6 +148,43 @@ int main() {
     static const char *s5name = "test5";
 
     try {
+        // the global records no session accepts are not even formatted
+        {
+            std::size_t formatted = 0;
+            const auto arg = [&formatted]() { return ++formatted; };
+            YAL_ASSERT_TERM(std::cerr, yal::logger::max_level() == yal::disable);
+            YAL_GLOBAL_LOG_ERROR("lvl-E: {}", arg());
+            YAL_ASSERT_TERM(std::cerr, formatted == 0);
+            {
+                YAL_SESSION_CREATE(lvl, "lvl/lvl", 1024*1024, yal::sec_res);
+                YAL_ASSERT_TERM(std::cerr, yal::logger::max_level() == yal::info);
+                YAL_SESSION_SET_LEVEL(lvl, yal::warning);
+                YAL_ASSERT_TERM(std::cerr, yal::logger::max_level() == yal::warning);
+                YAL_GLOBAL_LOG_INFO("lvl-I: {}", arg());
+                YAL_ASSERT_TERM(std::cerr, formatted == 0);
+                YAL_GLOBAL_LOG_WARNING("lvl-W: {}", arg());
+                YAL_ASSERT_TERM(std::cerr, formatted == 1);
+                {
+                    YAL_SESSION_CREATE(lvl2, "lvl/lvl2", 1024*1024, yal::sec_res);
+                    YAL_ASSERT_TERM(std::cerr, yal::logger::max_level() == yal::info);
+                    YAL_GLOBAL_LOG_DEBUG("lvl-D: {}", arg());
+                    YAL_ASSERT_TERM(std::cerr, formatted == 2);
+                }
+                YAL_ASSERT_TERM(std::cerr, yal::logger::max_level() == yal::warning);
+                YAL_GLOBAL_LOG_DEBUG("lvl-D: {}", arg());
+                YAL_ASSERT_TERM(std::cerr, formatted == 2);
+            }
+            YAL_ASSERT_TERM(std::cerr, yal::logger::max_level() == yal::disable);
+            YAL_GLOBAL_LOG_ERROR("lvl-E: {}", arg());
+            YAL_ASSERT_TERM(std::cerr, formatted == 2);
+
+            const auto files = list_files("lvl", "lvl-");
+            const auto files2 = list_files("lvl", "lvl2-");
+            YAL_ASSERT_TERM(std::cerr, files.size() == 1 && files2.size() == 1);
+            YAL_ASSERT_TERM(std::cerr, count_lines("lvl/" + files[0], "lvl-") == 1 && count_lines("lvl/" + files[0], "lvl-W: 1") == 1);
+            YAL_ASSERT_TERM(std::cerr, count_lines("lvl/" + files2[0], "lvl-") == 1 && count_lines("lvl/" + files2[0], "lvl-D: 2") == 1);
+        }
+
         YAL_SESSION_CREATE(test1, s1name, 1024*1024, yal::sec_res|yal::create_index_file,
             [](const char *ptr, std::size_t size) { return std::make_pair(ptr, size); }
         );
@@ -59,6 +200,542 @@ int main() {
         YAL_SESSION_CREATE(test4, s4name, 1024*1024, yal::nsec_res|yal::compress);
         YAL_ASSERT_TERM(std::cerr, YAL_SESSION_GET_FLAGS(test4) == (yal::nsec_res|yal::compress));
 
+        YAL_SESSION_CREATE_MANY(many, {
+             {"many/many1", 1024*1024, yal::msec_res|yal::precreate_next_volume|yal::use_manifest_file|yal::create_summary_file}
+            ,{"many/many2", 1024*1024, yal::msec_res|yal::remove_empty_logs|yal::fold_repeated}
+            ,{"many/many3", 1024*1024, yal::msec_res|yal::use_manifest_file|yal::per_thread_buffers|yal::reorder_records}
+            ,{"many/many4", 1024*1024, yal::msec_res|yal::lazy_volume_create}
+        }, 2);
+        YAL_ASSERT_TERM(std::cerr, many.size() == 4);
+        YAL_ASSERT_TERM(std::cerr, YAL_SESSION_EXISTS("many/many2"));
+        YAL_SESSION_SET_RETENTION(many[0], 0, 4); // keep the last 4 closed volumes
+        for ( auto idx = 0; idx < 3; ++idx ) {
+            YAL_LOG_INFO(many[1], "many2-I: {}", many.size());
+        }
+        YAL_LOG_INFO(many[1], "many2-I: {}", 0);
+        YAL_SESSION_FLUSH(many[1]);
+        {
+            // the repeats are written once the different record comes
+            const auto files = list_files("many", "many2-");
+            YAL_ASSERT_TERM(std::cerr, files.size() == 1);
+            const std::string volume = "many/" + files[0];
+            YAL_ASSERT_TERM(std::cerr, count_lines(volume, "many2-I: 4") == 1 && count_lines(volume, "many2-I: 0") == 1);
+            YAL_ASSERT_TERM(std::cerr, count_lines(volume, "]: last message repeated 2 times (") == 1);
+            std::ifstream file(volume);
+            std::string line;
+            std::getline(file, line);
+            YAL_ASSERT_TERM(std::cerr, line.find("many2-I: 4") != std::string::npos);
+            std::getline(file, line);
+            YAL_ASSERT_TERM(std::cerr, line.find("[I][main.cpp:") != std::string::npos && line.find("last message repeated 2 times") != std::string::npos);
+            std::getline(file, line);
+            YAL_ASSERT_TERM(std::cerr, line.find("many2-I: 0") != std::string::npos);
+        }
+        YAL_SESSION_SET_BUDGET(many[3], 1024, 1024, yal::budget_downgrade);
+        YAL_LOG_WARNING(many[3], "many4-W: {}", std::string(2048, 'x')); // downgraded
+        YAL_SESSION_FLUSH(many[3]);
+        YAL_ASSERT_TERM(std::cerr, YAL_SESSION_GET_DOWNGRADED_RECORDS(many[3]) == 1);
+        YAL_SESSION_SET_BUDGET(many[3], 0, 0);
+
+        // the terminal gets the records as the budget keeps them
+        {
+            std::fflush(stdout);
+            const int saved = ::dup(1);
+            std::FILE *out = std::fopen("term.out", "w");
+            ::dup2(::fileno(out), 1);
+            std::fclose(out);
+            {
+                YAL_SESSION_CREATE(term, "term/term", 1024*1024, yal::sec_res);
+                YAL_SESSION_TO_TERM(term, true, "");
+                YAL_SESSION_SET_BUDGET(term, 1024, 1024, yal::budget_downgrade);
+                YAL_LOG_INFO(term, "term-I: {}", std::string(2048, 'x')); // downgraded
+                YAL_SESSION_SET_BUDGET(term, 1, 1);
+                YAL_LOG_INFO(term, "term-I: {}", "dropped");
+            }
+            std::fflush(stdout);
+            ::dup2(saved, 1);
+            ::close(saved);
+
+            YAL_ASSERT_TERM(std::cerr, count_lines("term.out", "term-I: ") == 1);
+            YAL_ASSERT_TERM(std::cerr, count_lines("term.out", "term-I: " + std::string(YAL_BUDGET_DOWNGRADE_LEN-8, 'x') + "...") == 1);
+            YAL_ASSERT_TERM(std::cerr, count_lines("term.out", std::string(YAL_BUDGET_DOWNGRADE_LEN, 'x')) == 0);
+        }
+        YAL_SESSION_SET_LEVEL(many[3], yal::warning);
+        YAL_CALLSITES_ENABLE("main.cpp", "", __LINE__+1); // enables the next line only
+        YAL_LOG_DEBUG(many[3], "many4-D: {}", many.size());
+        YAL_LOG_DEBUG(many[3], "many4-D: never written");
+        YAL_CALLSITES_RESET();
+        YAL_SESSION_FLUSH(many[3]);
+        {
+            const auto files = list_files("many", "many4-");
+            YAL_ASSERT_TERM(std::cerr, files.size() == 1 && count_lines("many/" + files[0], "many4-D: 4") == 1);
+            YAL_ASSERT_TERM(std::cerr, count_lines("many/" + files[0], "many4-D: never written") == 0);
+        }
+        for ( auto idx = 0; idx < 10; ++idx ) {
+            YAL_LOG_WARNING_EVERY_N(many[3], 4, "many4-W: every 4th: {}", idx);
+            YAL_LOG_WARNING_RATE(many[3], 2, "many4-W: 2 per second: {}", idx);
+            YAL_LOG_WARNING_SAMPLED(many[3], 0.5, "many4-W: sampled: {}", idx);
+        }
+
+        // the suppressed records are counted by the next passed one, or reported when the callsite is quiet
+        {
+            YAL_SESSION_CREATE(thr, "thr/thr", 1024*1024, yal::sec_res);
+            for ( auto idx = 0; idx < 10; ++idx ) {
+                YAL_LOG_WARNING_EVERY_N(thr, 4, "thr-W: every 4th: {}", idx);
+                YAL_LOG_WARNING_RATE(thr, 0, "thr-W: never: {}", idx);
+            }
+            YAL_SESSION_FLUSH(thr);
+            const auto files = list_files("thr", "thr-");
+            YAL_ASSERT_TERM(std::cerr, files.size() == 1);
+            const std::string volume = "thr/" + files[0];
+            YAL_ASSERT_TERM(std::cerr, count_lines(volume, "thr-W: every 4th: 0") == 1);
+            YAL_ASSERT_TERM(std::cerr, count_lines(volume, "thr-W: every 4th: 4 (suppressed 3 records)") == 1);
+            YAL_ASSERT_TERM(std::cerr, count_lines(volume, "thr-W: every 4th: 8 (suppressed 3 records)") == 1);
+            YAL_ASSERT_TERM(std::cerr, count_lines(volume, "thr-W: never") == 0);
+            for ( auto idx = 0; idx < 100 && count_lines(volume, "suppressed ") < 4; ++idx ) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                YAL_SESSION_FLUSH(thr);
+            }
+            YAL_ASSERT_TERM(std::cerr, count_lines(volume, "suppressed ") == 4);
+            YAL_ASSERT_TERM(std::cerr, count_lines(volume, "suppressed 1 records of ") == 1);
+            YAL_ASSERT_TERM(std::cerr, count_lines(volume, "suppressed 10 records of ") == 1);
+        }
+
+        YAL_SESSION_SET_REORDER_WINDOW(many[2], 2000);
+        YAL_ASSERT_TERM(std::cerr, YAL_SESSION_GET_REORDER_WINDOW(many[2]) == 2000);
+        std::thread([&many]() { YAL_LOG_INFO(many[2], "many3-I: {}", many.size()); }).join();
+
+        // the session name with '-' still matches its own volumes on the restart
+        {
+            YAL_SESSION_CREATE(dash, "dash/my-svc", 1024*1024, yal::sec_res);
+            YAL_LOG_INFO(dash, "dash-I: {}", 1);
+        }
+        // the unfinished volume left by a crash
+        std::ofstream("dash/my-svc-00001-2020.01.01-00.00.00.active") << "dash-I: crashed" << std::endl;
+        {
+            YAL_SESSION_CREATE(dash, "dash/my-svc", 1024*1024, yal::sec_res);
+            const auto files = list_files("dash", "my-svc-");
+            YAL_ASSERT_TERM(std::cerr, has_file(files, "my-svc-00000-"));
+            YAL_ASSERT_TERM(std::cerr, has_file(files, "my-svc-00001-2020.01.01-00.00.00") && files.size() == 3);
+            YAL_ASSERT_TERM(std::cerr, !has_file(files, "my-svc-00001-2020.01.01-00.00.00.active"));
+            YAL_ASSERT_TERM(std::cerr, has_file(files, "my-svc-00002-"));
+        }
+
+        // several writers into one session: every record is written once, whole and in the order of its writer
+        for ( const std::uint32_t opts: {0u, static_cast<std::uint32_t>(yal::per_thread_buffers)} ) {
+            static const std::size_t threads = 4, records = 5000;
+            {
+                YAL_SESSION_CREATE(mt, "mt/mt", 1024*1024*64, yal::usec_res|opts);
+                std::vector<std::thread> writers;
+                for ( std::size_t t = 0; t < threads; ++t ) {
+                    writers.emplace_back([&mt, t]() {
+                        const std::string payload(40, static_cast<char>('a'+t));
+                        for ( std::size_t idx = 0; idx < records; ++idx ) {
+                            YAL_LOG_INFO(mt, "mt-I: t={} i={} {}", t, idx, payload);
+                        }
+                    });
+                }
+                for ( auto &it: writers ) {
+                    it.join();
+                }
+            }
+
+            const auto files = list_files("mt", "mt-");
+            YAL_ASSERT_TERM(std::cerr, files.size() == 1);
+            std::size_t next[threads] = {}, lines = 0, bad = 0;
+            std::ifstream file("mt/" + files[0]);
+            for ( std::string line; std::getline(file, line); ++lines ) {
+                std::size_t t = 0, idx = 0;
+                const auto pos = line.find("]: mt-I: t=");
+                if ( pos == std::string::npos || std::sscanf(line.c_str()+pos, "]: mt-I: t=%zu i=%zu", &t, &idx) != 2
+                    || t >= threads || idx != next[t] || line.size() < 41 || line.compare(line.size()-41, 41, " " + std::string(40, static_cast<char>('a'+t))) != 0 )
+                {
+                    ++bad;
+                    continue;
+                }
+                ++next[t];
+            }
+            YAL_ASSERT_TERM(std::cerr, lines == threads * records && bad == 0);
+            for ( auto it: next ) {
+                YAL_ASSERT_TERM(std::cerr, it == records);
+            }
+            std::remove(("mt/" + files[0]).c_str());
+        }
+
+        // the records of several writers are written in timestamp order within the window
+        {
+            YAL_SESSION_CREATE(ro, "ro/ord", 1024*1024*64, yal::nsec_res|yal::per_thread_buffers|yal::reorder_records);
+            YAL_SESSION_SET_REORDER_WINDOW(ro, 10*1000*1000); // longer than the test
+            std::vector<std::thread> writers;
+            for ( std::size_t t = 0; t < 4; ++t ) {
+                writers.emplace_back([&ro, t]() {
+                    for ( std::size_t idx = 0; idx < 1000; ++idx ) {
+                        YAL_LOG_INFO(ro, "ord-I: t={} i={}", t, idx);
+                    }
+                });
+            }
+            for ( auto &it: writers ) {
+                it.join();
+            }
+            YAL_SESSION_FLUSH(ro);
+            YAL_ASSERT_TERM(std::cerr, YAL_SESSION_GET_LATE_RECORDS(ro) == 0);
+        }
+        {
+            const auto files = list_files("ro", "ord-");
+            YAL_ASSERT_TERM(std::cerr, files.size() == 1 && count_lines("ro/" + files[0], "ord-I: ") == 4000);
+            // '[yyyy.mm.dd-hh:mm:ss.nnnnnnnnn]' is ordered as the text
+            std::ifstream file("ro/" + files[0]);
+            std::string prev, line;
+            std::size_t unordered = 0;
+            while ( std::getline(file, line) ) {
+                const std::string ts = line.substr(0, line.find(']'));
+                unordered += ts < prev;
+                prev = ts;
+            }
+            YAL_ASSERT_TERM(std::cerr, unordered == 0);
+        }
+        // the record older than the already written ones is written as is and counted
+        {
+            gate g;
+            YAL_SESSION_CREATE(ro, "ro/late", 1024*1024, yal::nsec_res|yal::per_thread_buffers|yal::reorder_records, yal::detail::process_buffer(), gated(&g));
+            YAL_SESSION_SET_REORDER_WINDOW(ro, 0);
+            auto holder = g.close(ro);
+            std::atomic<bool> stamping{false};
+            std::thread late([&ro, &stamping]() {
+                // fills its own buffer, so the next record waits for the space after taking its timestamp
+                YAL_SESSION_SET_OVERFLOW(ro, yal::overflow_drop_newest);
+                for ( auto idx = 0; idx < 100000 && YAL_SESSION_GET_DROPPED_RECORDS(ro) == 0; ++idx ) {
+                    YAL_LOG_INFO(ro, "late-I: fill {}", idx);
+                }
+                YAL_SESSION_SET_OVERFLOW(ro, yal::overflow_block);
+                stamping = true;
+                YAL_LOG_INFO(ro, "late-I: older");
+            });
+            while ( !stamping )
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            YAL_LOG_INFO(ro, "late-I: newer");
+            g.open(holder);
+            late.join();
+            YAL_SESSION_FLUSH(ro);
+            YAL_ASSERT_TERM(std::cerr, YAL_SESSION_GET_DROPPED_RECORDS(ro) == 1);
+            YAL_ASSERT_TERM(std::cerr, YAL_SESSION_GET_LATE_RECORDS(ro) == 1 && YAL_SESSION_GET_STATS(ro).late == 1);
+        }
+        {
+            const auto files = list_files("ro", "late-");
+            YAL_ASSERT_TERM(std::cerr, files.size() == 1);
+            std::ifstream file("ro/" + files[0]);
+            std::string line, newer, older;
+            while ( std::getline(file, line) ) {
+                if ( line.find("late-I: newer") != std::string::npos ) newer = line;
+                if ( line.find("late-I: older") != std::string::npos ) {
+                    older = line;
+                    // written after the newer one
+                    YAL_ASSERT_TERM(std::cerr, !newer.empty());
+                }
+            }
+            YAL_ASSERT_TERM(std::cerr, !older.empty() && older.substr(0, older.find(']')) < newer.substr(0, newer.find(']')));
+        }
+
+        // the volume is created by the first write
+        {
+            YAL_SESSION_CREATE(lazy, "lazy/lazy", 1024*1024, yal::sec_res|yal::lazy_volume_create);
+            YAL_ASSERT_TERM(std::cerr, list_files("lazy", "lazy-").empty());
+            YAL_LOG_INFO(lazy, "lazy-I: {}", 1);
+            YAL_SESSION_FLUSH(lazy);
+            YAL_ASSERT_TERM(std::cerr, list_files("lazy", "lazy-").size() == 1);
+        }
+        {
+            const auto files = list_files("lazy", "lazy-00000-");
+            YAL_ASSERT_TERM(std::cerr, files.size() == 1 && count_lines("lazy/" + files[0], "lazy-I: 1") == 1);
+        }
+
+        // the pre-created volume is named by the time it's swapped in, and removed if never used
+        {
+            YAL_SESSION_CREATE(pre, "pre/pre", 1024*1024, yal::sec_res|yal::precreate_next_volume);
+            YAL_SESSION_SET_ROTATION_INTERVAL(pre, 1);
+            for ( auto idx = 0; idx < 1000 && !has_file(list_files("pre", "pre-"), "pre-00001-"); ++idx ) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            YAL_ASSERT_TERM(std::cerr, has_file(list_files("pre", "pre-"), "pre-00001-"));
+            std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+            YAL_LOG_INFO(pre, "pre-I: {}", 1); // rotates
+            YAL_SESSION_FLUSH(pre);
+            for ( auto idx = 0; idx < 1000 && !has_file(list_files("pre", "pre-"), "pre-00002-"); ++idx ) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            YAL_ASSERT_TERM(std::cerr, has_file(list_files("pre", "pre-"), "pre-00002-"));
+        }
+        {
+            const auto first = list_files("pre", "pre-00000-");
+            const auto second = list_files("pre", "pre-00001-");
+            YAL_ASSERT_TERM(std::cerr, first.size() == 1 && second.size() == 1);
+            // 'pre-0000N-yyyy.mm.dd-hh.mm.ss'
+            YAL_ASSERT_TERM(std::cerr, second[0].substr(10) > first[0].substr(10));
+            YAL_ASSERT_TERM(std::cerr, count_lines("pre/" + second[0], "pre-I: 1") == 1);
+            YAL_ASSERT_TERM(std::cerr, list_files("pre", "pre-00002-").empty());
+        }
+
+        // the sessions sharing a directory scan keep their own 'remove_empty_logs'
+        {
+            YAL_SESSION_CREATE(mixed, "mixed/keep", 1024*1024, yal::sec_res|yal::lazy_volume_create);
+        }
+        std::ofstream("mixed/keep-00000-2020.01.01-00.00.00.active");
+        std::ofstream("mixed/rm-00000-2020.01.01-00.00.00.active");
+        {
+            YAL_SESSION_CREATE_MANY(mixed, {
+                 {"mixed/keep", 1024*1024, yal::sec_res}
+                ,{"mixed/rm", 1024*1024, yal::sec_res|yal::remove_empty_logs}
+            }, 2);
+            const auto files = list_files("mixed", "");
+            YAL_ASSERT_TERM(std::cerr, has_file(files, "keep-00000-2020.01.01-00.00.00") && has_file(files, "keep-00001-"));
+            YAL_ASSERT_TERM(std::cerr, !has_file(files, "keep-00000-2020.01.01-00.00.00.active"));
+            YAL_ASSERT_TERM(std::cerr, !has_file(files, "rm-00000-2020.01.01-00.00.00") && has_file(files, "rm-00000-"));
+        }
+
+        // the summary is written when the volume is closed
+        {
+            YAL_SESSION_CREATE(sum, "sum/sum", 1024*1024, yal::nsec_res|yal::create_summary_file);
+            YAL_ASSERT_TERM(std::cerr, YAL_SESSION_GET_FLAGS(sum) == (yal::nsec_res|yal::create_summary_file));
+            for ( auto idx = 0; idx < 3; ++idx ) {
+                YAL_LOG_INFO(sum, "sum-I: {}", idx);
+            }
+            YAL_LOG_WARNING(sum, "sum-W: {}", 1);
+            YAL_LOG_ERROR(sum, "sum-E: {}", 2);
+        }
+        {
+            const auto files = list_files("sum", "sum-00000-");
+            YAL_ASSERT_TERM(std::cerr, files.size() == 2);
+            const std::string &sumfname = files[0].size() > files[1].size() ? files[0] : files[1];
+
+            yal::volume_summary sum{};
+            YAL_ASSERT_TERM(std::cerr, yal::summary_read(&sum, "sum/" + sumfname));
+            YAL_ASSERT_TERM(std::cerr, sum.infos == 3 && sum.warnings == 1 && sum.errors == 1);
+            YAL_ASSERT_TERM(std::cerr, sum.options == (yal::nsec_res|yal::create_summary_file));
+            YAL_ASSERT_TERM(std::cerr, sum.callsites == 3 && sum.first_ts <= sum.last_ts);
+            YAL_ASSERT_TERM(std::cerr, yal::summary_overlaps(sum, sum.last_ts, UINT64_MAX));
+            YAL_ASSERT_TERM(std::cerr, !yal::summary_overlaps(sum, 0, sum.first_ts - 1));
+            YAL_ASSERT_TERM(std::cerr, owner_only("sum/" + sumfname));
+        }
+
+        // on the restart the volume number comes from the manifest, not from the directory
+        {
+            YAL_SESSION_CREATE(man, "man/man", 1024*1024, yal::sec_res|yal::compress|yal::use_manifest_file);
+            YAL_ASSERT_TERM(std::cerr, YAL_SESSION_GET_FLAGS(man) == (yal::sec_res|yal::compress|yal::use_manifest_file));
+            YAL_LOG_INFO(man, "man-I: {}", 1);
+        }
+        {
+            // pretends the process crashed while writing the volume number 5
+            const auto files = list_files("man", "man-00000-");
+            YAL_ASSERT_TERM(std::cerr, files.size() == 1);
+            const std::string volume = "man/" + files[0];
+            YAL_ASSERT_TERM(std::cerr, std::rename(volume.c_str(), (volume + ".active").c_str()) == 0);
+            std::ofstream("man/man.manifest")
+                << "volume=5\nlogfile=" << volume << "\nidxfile=\nstate=active\n";
+        }
+        {
+            YAL_SESSION_CREATE(man, "man/man", 1024*1024, yal::sec_res|yal::compress|yal::use_manifest_file);
+            const auto files = list_files("man", "man-");
+            YAL_ASSERT_TERM(std::cerr, files.size() == 2 && has_file(files, "man-00006-"));
+            // the unfinished volume is renamed back
+            const auto recovered = list_files("man", "man-00000-");
+            YAL_ASSERT_TERM(std::cerr, recovered.size() == 1 && recovered[0].find(".active") == std::string::npos);
+            YAL_ASSERT_TERM(std::cerr, owner_only("man/man.manifest"));
+        }
+        // the crash after the pre-created volume 4 was written, but before the manifest was updated
+        {
+            YAL_SESSION_CREATE(mc, "mancrash/mc", 1024*1024, yal::sec_res|yal::lazy_volume_create);
+        }
+        std::ofstream("mancrash/mc-00003-2020.01.01-00.00.00") << "mc-I: 3" << std::endl;
+        std::ofstream("mancrash/mc-00004-2020.01.01-01.00.00.active") << "mc-I: 4" << std::endl;
+        std::ofstream("mancrash/mc.manifest")
+            << "volume=3\nlogfile=mancrash/mc-00003-2020.01.01-00.00.00\nidxfile=\nstate=closed\n"
+            << "nextlog=mancrash/mc-00004-2020.01.01-01.00.00\nnextidx=\n";
+        {
+            YAL_SESSION_CREATE(mc, "mancrash/mc", 1024*1024, yal::sec_res|yal::use_manifest_file|yal::precreate_next_volume);
+            const auto files = list_files("mancrash", "mc-");
+            YAL_ASSERT_TERM(std::cerr, has_file(files, "mc-00004-2020.01.01-01.00.00"));
+            YAL_ASSERT_TERM(std::cerr, list_files("mancrash", "mc-00004-")[0].find(".active") == std::string::npos);
+            YAL_ASSERT_TERM(std::cerr, has_file(files, "mc-00005-") && !has_file(files, "mc-00004-2020.01.01-01.00.00.active"));
+        }
+
+        // the lower levels are shed first, the errors never
+        {
+            gate g;
+            YAL_SESSION_CREATE(shed, "shed/shed", 1024*1024, yal::sec_res|yal::shed_under_backlog, yal::detail::process_buffer(), gated(&g));
+            auto holder = g.close(shed);
+            std::size_t idx = 0;
+            for ( ; idx < 10000 && YAL_SESSION_GET_SHED_RECORDS(shed) == 0; ++idx ) {
+                YAL_LOG_INFO(shed, "shed-I: {}", idx);
+            }
+            YAL_LOG_DEBUG(shed, "shed-D: {}", idx);
+            YAL_LOG_WARNING(shed, "shed-W: {}", idx);
+            YAL_ASSERT_TERM(std::cerr, YAL_SESSION_GET_SHED_RECORDS(shed) == 1);
+
+            for ( ; idx < 10000 && YAL_SESSION_GET_SHED_RECORDS(shed) == 1; ++idx ) {
+                YAL_LOG_DEBUG(shed, "shed-D: {}", idx);
+            }
+            YAL_LOG_INFO(shed, "shed-I: {}", idx);
+            YAL_LOG_WARNING(shed, "shed-W: {}", idx);
+            YAL_ASSERT_TERM(std::cerr, YAL_SESSION_GET_SHED_RECORDS(shed) == 3);
+
+            for ( ; idx < 10000 && YAL_SESSION_GET_SHED_RECORDS(shed) == 3; ++idx ) {
+                YAL_LOG_WARNING(shed, "shed-W: {}", idx);
+            }
+            YAL_LOG_INFO(shed, "shed-I: {}", idx);
+            YAL_LOG_DEBUG(shed, "shed-D: {}", idx);
+            YAL_LOG_ERROR(shed, "shed-E: {}", idx);
+            YAL_ASSERT_TERM(std::cerr, YAL_SESSION_GET_SHED_RECORDS(shed) == 6);
+            g.open(holder);
+
+            YAL_SESSION_FLUSH(shed);
+            YAL_ASSERT_TERM(std::cerr, YAL_SESSION_GET_STATS(shed).shed == 6);
+        }
+        {
+            const auto files = list_files("shed", "shed-");
+            YAL_ASSERT_TERM(std::cerr, files.size() == 1);
+            const std::string volume = "shed/" + files[0];
+            YAL_ASSERT_TERM(std::cerr, count_lines(volume, "shed-E: ") == 1);
+            YAL_ASSERT_TERM(std::cerr, count_lines(volume, "load shedding: dropping info, debug and warning records") == 1);
+        }
+
+        // the write latency and the throughput limits shed as the buffer depth does
+        for ( const auto &limits: {std::make_pair(1, 0), std::make_pair(0, 1)} ) {
+            {
+                YAL_SESSION_CREATE(shed, "shed/limits", 1024*1024, yal::sec_res|yal::shed_under_backlog);
+                YAL_SESSION_SET_SHED_LIMITS(shed, limits.first, limits.second);
+                for ( auto idx = 0; idx < 2000 && YAL_SESSION_GET_SHED_RECORDS(shed) == 0; ++idx ) {
+                    YAL_LOG_INFO(shed, "limits-I: {}", idx);
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                YAL_ASSERT_TERM(std::cerr, YAL_SESSION_GET_SHED_RECORDS(shed) > 0);
+                YAL_LOG_ERROR(shed, "limits-E: {}", 1);
+
+                // without the limits only the buffer depth counts, and it's empty.
+                // the shed levels are restored one per record
+                YAL_SESSION_SET_SHED_LIMITS(shed, 0, 0);
+                for ( auto idx = 0; idx < 3; ++idx ) {
+                    YAL_LOG_INFO(shed, "limits-I: restoring {}", idx);
+                }
+                const auto shed_records = YAL_SESSION_GET_SHED_RECORDS(shed);
+                YAL_LOG_INFO(shed, "limits-I: {}", "unlimited");
+                YAL_ASSERT_TERM(std::cerr, YAL_SESSION_GET_SHED_RECORDS(shed) == shed_records);
+            }
+            const auto files = list_files("shed", "limits-");
+            YAL_ASSERT_TERM(std::cerr, files.size() == 1);
+            const std::string volume = "shed/" + files[0];
+            YAL_ASSERT_TERM(std::cerr, count_lines(volume, "limits-E: 1") == 1 && count_lines(volume, "limits-I: unlimited") == 1);
+            YAL_ASSERT_TERM(std::cerr, count_lines(volume, "load shedding: dropping info") >= 1);
+            YAL_ASSERT_TERM(std::cerr, count_lines(volume, "load shedding: dropping no records") == 1);
+            std::remove(volume.c_str());
+        }
+
+        // the overflow policies, while the sink is busy and the buffer is full
+        {
+            gate g;
+            YAL_SESSION_CREATE(ovf, "ovf/block", 1024*1024, yal::sec_res, yal::detail::process_buffer(), gated(&g));
+            YAL_ASSERT_TERM(std::cerr, YAL_SESSION_GET_OVERFLOW(ovf) == yal::overflow_block);
+            auto holder = g.close(ovf);
+            std::thread opener([&g, &holder]() {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                g.open(holder);
+            });
+            for ( auto idx = 0; idx < 2000; ++idx ) {
+                YAL_LOG_INFO(ovf, "block-I: {}", idx);
+            }
+            opener.join();
+            YAL_ASSERT_TERM(std::cerr, YAL_SESSION_GET_BLOCKED_RECORDS(ovf) > 0 && YAL_SESSION_GET_DROPPED_RECORDS(ovf) == 0);
+        }
+        {
+            const auto files = list_files("ovf", "block-");
+            YAL_ASSERT_TERM(std::cerr, files.size() == 1 && count_lines("ovf/" + files[0], "block-I: ") == 2000);
+        }
+        std::size_t logged = 0;
+        {
+            gate g;
+            YAL_SESSION_CREATE(ovf, "ovf/timeout", 1024*1024, yal::sec_res, yal::detail::process_buffer(), gated(&g));
+            YAL_SESSION_SET_OVERFLOW(ovf, yal::overflow_block_timeout, 1);
+            auto holder = g.close(ovf);
+            for ( ; logged < 10000 && YAL_SESSION_GET_DROPPED_RECORDS(ovf) == 0; ++logged ) {
+                YAL_LOG_INFO(ovf, "timeout-I: {}", logged);
+            }
+            for ( auto idx = 0; idx < 2; ++idx, ++logged ) {
+                YAL_LOG_INFO(ovf, "timeout-I: {}", logged);
+            }
+            YAL_ASSERT_TERM(std::cerr, YAL_SESSION_GET_DROPPED_RECORDS(ovf) == 3 && YAL_SESSION_GET_BLOCKED_RECORDS(ovf) == 3);
+            g.open(holder);
+        }
+        {
+            const auto files = list_files("ovf", "timeout-");
+            YAL_ASSERT_TERM(std::cerr, files.size() == 1 && count_lines("ovf/" + files[0], "timeout-I: ") == logged - 3);
+        }
+        std::uint64_t dropped = 0;
+        {
+            gate g;
+            YAL_SESSION_CREATE(ovf, "ovf/oldest", 1024*1024, yal::sec_res, yal::detail::process_buffer(), gated(&g));
+            YAL_SESSION_SET_OVERFLOW(ovf, yal::overflow_drop_oldest);
+            auto holder = g.close(ovf);
+            std::thread opener([&g, &holder]() {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                g.open(holder);
+            });
+            for ( auto idx = 0; idx < 2000; ++idx ) {
+                YAL_LOG_INFO(ovf, "oldest-I: {}", idx);
+            }
+            opener.join();
+            dropped = YAL_SESSION_GET_DROPPED_RECORDS(ovf);
+        }
+        {
+            // every record is either written or counted, and the newest one is kept
+            const auto files = list_files("ovf", "oldest-");
+            YAL_ASSERT_TERM(std::cerr, files.size() == 1);
+            YAL_ASSERT_TERM(std::cerr, count_lines("ovf/" + files[0], "oldest-I: ") + dropped == 2000);
+            YAL_ASSERT_TERM(std::cerr, count_lines("ovf/" + files[0], "oldest-I: 1999") == 1);
+        }
+        {
+            gate g;
+            YAL_SESSION_CREATE(ovf, "ovf/spill", 1024*1024, yal::sec_res, yal::detail::process_buffer(), gated(&g));
+            YAL_SESSION_SET_OVERFLOW(ovf, yal::overflow_spill_to_file);
+            auto holder = g.close(ovf);
+            logged = 0;
+            for ( ; logged < 10000 && YAL_SESSION_GET_SPILLED_RECORDS(ovf) == 0; ++logged ) {
+                YAL_LOG_INFO(ovf, "spill-I: {}", logged);
+            }
+            for ( auto idx = 0; idx < 2; ++idx, ++logged ) {
+                YAL_LOG_INFO(ovf, "spill-I: {}", logged);
+            }
+            YAL_ASSERT_TERM(std::cerr, YAL_SESSION_GET_SPILLED_RECORDS(ovf) == 3 && YAL_SESSION_GET_DROPPED_RECORDS(ovf) == 0);
+            g.open(holder);
+            // only the records put into the buffer, and the one of the gate
+            YAL_ASSERT_TERM(std::cerr, YAL_SESSION_GET_STATS(ovf).records[yal::info] == logged - 3 + 1);
+        }
+        {
+            // the spilled records are the newest ones
+            const auto files = list_files("ovf", "spill-");
+            YAL_ASSERT_TERM(std::cerr, files.size() == 1 && count_lines("ovf/" + files[0], "spill-I: ") == logged - 3);
+            YAL_ASSERT_TERM(std::cerr, count_lines("ovf/spill.overflow", "spill-I: ") == 3 && owner_only("ovf/spill.overflow"));
+            YAL_ASSERT_TERM(std::cerr, count_lines("ovf/spill.overflow", fmt::format("spill-I: {}", logged - 1)) == 1);
+        }
+
+        // the global policy alone applies to every session
+        for ( auto idx = 0; idx < 2; ++idx ) {
+            YAL_SESSION_CREATE(keep, "keep/keep", 1024*1024, yal::sec_res);
+            YAL_LOG_INFO(keep, "keep-I: {}", idx);
+        }
+        for ( const auto &it: list_files("keep", "keep-") ) {
+            const struct ::utimbuf old{946684800, 946684800}; // 2000.01.01
+            ::utime(("keep/" + it).c_str(), &old);
+        }
+        {
+            YAL_SESSION_CREATE(keep, "keep/keep", 1024*1024, yal::sec_res);
+            YAL_SET_RETENTION(0, 0, 24*60*60); // a day
+            for ( auto idx = 0; idx < 50 && list_files("keep", "keep-").size() > 1; ++idx ) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            YAL_SET_RETENTION();
+            const auto files = list_files("keep", "keep-");
+            YAL_ASSERT_TERM(std::cerr, files.size() == 1 && has_file(files, "keep-00002-"));
+        }
+
     //		YAL_SESSION_TO_TERM(test1, true, "term1");
 
         for ( auto idx = 0ul, idx2 = 0ul; idx < 1024ul*10ul; idx+=2, idx2+=3 ) {
@@ -89,6 +766,92 @@ int main() {
         }
         YAL_FLUSH();
 
+        const auto stats1 = YAL_SESSION_GET_STATS(test1);
+        YAL_ASSERT_TERM(std::cerr, stats1.records[yal::error] == 1024ul*10ul); // its own and the global ones
+        YAL_ASSERT_TERM(std::cerr, stats1.latency.total == stats1.total_records());
+        YAL_ASSERT_TERM(std::cerr, stats1.latency.percentile(0.5) <= stats1.latency.percentile(0.99));
+        YAL_ASSERT_TERM(std::cerr, YAL_GET_STATS().size() >= 4);
+        YAL_EXPORT_METRICS("metrics.prom", 100); // the first export is done at once
+        YAL_EXPORT_METRICS("");
+        {
+            // 'name{labels} value'
+            std::map<std::string, double> metrics;
+            std::ifstream file("metrics.prom");
+            for ( std::string line; std::getline(file, line); ) {
+                const auto pos = line.rfind(' ');
+                if ( line.empty() || line[0] == '#' || pos == std::string::npos )
+                    continue;
+                metrics[line.substr(0, pos)] = std::stod(line.substr(pos+1));
+            }
+            YAL_ASSERT_TERM(std::cerr, owner_only("metrics.prom"));
+
+            static const std::pair<yal::level, const char*> levels[] = {
+                {yal::error, "error"}, {yal::warning, "warning"}, {yal::debug, "debug"}, {yal::info, "info"}
+            };
+            for ( const auto &st: YAL_GET_STATS() ) {
+                const std::string session = "session=\"" + st.name + "\"";
+                for ( const auto &lvl: levels ) {
+                    const std::string labels = "{" + session + ",level=\"" + lvl.second + "\"}";
+                    YAL_ASSERT_TERM(std::cerr, metrics.count("yal_records_total" + labels) && metrics.count("yal_bytes_total" + labels));
+                }
+                for ( const char *it: {"yal_records_per_second", "yal_queue_depth_bytes", "yal_write_latency_seconds_count", "yal_rotations_total"} ) {
+                    YAL_ASSERT_TERM(std::cerr, metrics.count(std::string(it) + "{" + session + "}"));
+                }
+            }
+            // nothing was written into 'test1' since its stats were taken
+            const std::string session = "session=\"" + stats1.name + "\"";
+            for ( const auto &lvl: levels ) {
+                const std::string labels = "{" + session + ",level=\"" + lvl.second + "\"}";
+                YAL_ASSERT_TERM(std::cerr, metrics["yal_records_total" + labels] == stats1.records[lvl.first]);
+                YAL_ASSERT_TERM(std::cerr, metrics["yal_bytes_total" + labels] == stats1.bytes[lvl.first]);
+            }
+            YAL_ASSERT_TERM(std::cerr, metrics["yal_write_latency_seconds_count{" + session + "}"] == stats1.latency.total);
+            YAL_ASSERT_TERM(std::cerr, metrics["yal_rotations_total{" + session + "}"] == stats1.rotations);
+            YAL_ASSERT_TERM(std::cerr, metrics["yal_dropped_records_total{" + session + ",reason=\"shed\"}"] == stats1.shed);
+        }
+        // the socket is not accessible by the others, and removed by the stop
+        YAL_EXPORT_METRICS("unix:metrics.sock", 100);
+        YAL_ASSERT_TERM(std::cerr, owner_only("metrics.sock"));
+        YAL_EXPORT_METRICS("");
+        YAL_ASSERT_TERM(std::cerr, list_files(".", "metrics.sock").empty());
+
+        const auto top = YAL_CALLSITES_TOP(3);
+        YAL_ASSERT_TERM(std::cerr, top.size() == 3 && top[0]->bytes() >= top[1]->bytes() && top[0]->hits());
+        YAL_CALLSITES_REPORT(test1, 10, 60);
+        YAL_CALLSITES_REPORT(test1, 0, 0);
+        // the report covers the records since the previous one, the noisiest callsite first
+        {
+            YAL_SESSION_CREATE(rep, "rep/rep", 1024*1024, yal::sec_res);
+            const auto files = list_files("rep", "rep-");
+            YAL_ASSERT_TERM(std::cerr, files.size() == 1);
+            const std::string volume = "rep/" + files[0];
+            YAL_CALLSITES_REPORT(rep, 2, 1);
+            for ( auto idx = 0; idx < 300 && count_lines(volume, "top callsite 1/") == 0; ++idx ) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                YAL_SESSION_FLUSH(rep);
+            }
+            YAL_ASSERT_TERM(std::cerr, count_lines(volume, "top callsite 1/2 for the last 1 sec: ") == 1);
+
+            const std::size_t line_a = __LINE__ + 2;
+            for ( auto idx = 0; idx < 20; ++idx ) {
+                YAL_LOG_INFO(rep, "rep-A: {}", std::string(93, 'a'));
+            }
+            const std::size_t line_b = __LINE__ + 2;
+            for ( auto idx = 0; idx < 10; ++idx ) {
+                YAL_LOG_INFO(rep, "rep-B: {}", idx);
+            }
+            for ( auto idx = 0; idx < 300 && count_lines(volume, "top callsite 1/") < 2; ++idx ) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                YAL_SESSION_FLUSH(rep);
+            }
+            YAL_CALLSITES_REPORT(rep, 0, 0);
+            YAL_SESSION_FLUSH(rep);
+
+            YAL_ASSERT_TERM(std::cerr, count_lines(volume, "top callsite 1/") == 2 && count_lines(volume, "top callsite 2/2") == 2);
+            YAL_ASSERT_TERM(std::cerr, count_lines(volume, fmt::format("top callsite 1/2 for the last 1 sec: {}:{} main(): 20 records, 2000 bytes", __FILE__, line_a)) == 1);
+            YAL_ASSERT_TERM(std::cerr, count_lines(volume, fmt::format("top callsite 2/2 for the last 1 sec: {}:{} main(): 10 records, 80 bytes", __FILE__, line_b)) == 1);
+        }
+
         YAL_SESSION_GET2(ts1, s1name);
         YAL_ASSERT_TERM(std::cerr, ts1);
         YAL_SESSION_GET2(ts2, s2name);
@@ -108,6 +871,8 @@ int main() {
 
         YAL_SESSION_CREATE(test5, s5name, 1024*10, yal::usec_res);
         YAL_SESSION_TO_TERM(test5, true, "test5 term");
+        YAL_SESSION_SET_ROTATION_INTERVAL(test5, 2);
+        YAL_ASSERT_TERM(std::cerr, YAL_SESSION_GET_ROTATION_INTERVAL(test5) == 2);
         YAL_TEST_LESS   (test5, 0, 1);
         YAL_TEST_LESS   (test5, 1, 1); // test fail
         YAL_TEST_LESSEQ (test5, 1, 1);
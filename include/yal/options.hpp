@@ -47,6 +47,16 @@ enum options: std::size_t {
     ,full_source_name    = 1u<<7u  // don't show full file path
     ,full_func_name      = 1u<<8u  // i.e. 'void func(int)'
     ,create_index_file   = 1u<<9u  // create index-file for each log file
+    ,create_summary_file = 1u<<10u // create summary-file for each closed volume
+    ,use_manifest_file   = 1u<<11u // keep the session state in manifest-file instead of scanning the directory
+    ,lazy_volume_create  = 1u<<12u // don't create the volume until the first record is written
+    ,precreate_next_volume = 1u<<13u // create the next volume in the background thread
+    ,rotate_hourly       = 1u<<14u // start a new volume every hour
+    ,rotate_daily        = 1u<<15u // start a new volume every day
+    ,per_thread_buffers  = 1u<<16u // each thread writes to its own buffer, the volume is written by the session's thread
+    ,reorder_records     = 1u<<17u // hold the records for 'reorder_window' microseconds and write them in timestamp order
+    ,fold_repeated       = 1u<<18u // write the same consecutive records of a callsite once, then 'last message repeated N times'
+    ,shed_under_backlog  = 1u<<19u // drop info, then debug, then warning records while the buffer is too deep
 };
 
 } // ns yal
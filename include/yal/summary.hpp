@@ -0,0 +1,73 @@
+
+// Copyright (c) 2013-2020 niXman (i dotty nixman doggy gmail dotty com)
+// All rights reserved.
+//
+// This file is part of YAL(https://github.com/niXman/yal) project.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//   Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+//   Redistributions in binary form must reproduce the above copyright notice, this
+//   list of conditions and the following disclaimer in the documentation and/or
+//   other materials provided with the distribution.
+//
+//   Neither the name of the {organization} nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _yal__summary_hpp
+#define _yal__summary_hpp
+
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+namespace yal {
+
+/**************************************************************************/
+
+// the summary is written next to each volume(as '<volume>.sum') when the
+// volume is closed. it allows to skip the whole volume without opening it.
+struct volume_summary {
+	std::uint64_t first_ts;       // timestamp of the first record, in nanoseconds
+	std::uint64_t last_ts;        // timestamp of the last record, in nanoseconds
+	std::uint64_t records;        // total number of records
+	std::uint64_t errors;         // number of 'error' records
+	std::uint64_t warnings;       // number of 'warning' records
+	std::uint64_t debugs;         // number of 'debug' records
+	std::uint64_t infos;          // number of 'info' records
+	std::uint64_t data_bytes;     // bytes of the formatted records
+	std::uint64_t volume_bytes;   // bytes passed to the volume(after process_buffer)
+	std::uint64_t index_bytes;    // bytes of the index-file
+	std::uint64_t options;        // session options
+	std::uint64_t callsites;      // number of distinct callsites
+	std::uint64_t callsites_hash; // FNV-1a of the sorted callsites
+};
+
+/**************************************************************************/
+
+std::uint64_t summary_callsites_hash(std::vector<std::string> callsites);
+bool summary_write(const volume_summary &sum, const std::string &fname);
+bool summary_read(volume_summary *sum, const std::string &fname);
+bool summary_overlaps(const volume_summary &sum, std::uint64_t from_ts, std::uint64_t to_ts);
+
+/**************************************************************************/
+
+} // ns yal
+
+#endif // _yal__summary_hpp
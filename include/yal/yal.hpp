@@ -41,11 +41,13 @@
 #include "libfmt/include/fmt/ostream.h"
 #include "libfmt/include/fmt/format.h"
 
+#include <atomic>
 #include <cstdint>
 #include <cstring>
 #include <climits>
 #include <memory>
 #include <functional>
+#include <vector>
 
 /***************************************************************************/
 
@@ -57,6 +59,54 @@
 #   define YAL_COMPRESSION_LEVEL 1
 #endif // YAL_COMPRESSION_LEVEL
 
+#ifndef YAL_SESSION_BUFFER_SIZE
+#   define YAL_SESSION_BUFFER_SIZE (64*1024) // must be a power of two
+#endif // YAL_SESSION_BUFFER_SIZE
+
+#ifndef YAL_BACKEND_IDLE_WAIT
+#   define YAL_BACKEND_IDLE_WAIT 1000 // in microseconds
+#endif // YAL_BACKEND_IDLE_WAIT
+
+#ifndef YAL_REORDER_WINDOW
+#   define YAL_REORDER_WINDOW 1000 // in microseconds
+#endif // YAL_REORDER_WINDOW
+
+// the buffer depths, in percents, to start shedding the levels at(see 'shed_under_backlog').
+// a level is restored when the depth falls below the half of its threshold.
+#ifndef YAL_SHED_INFO_DEPTH
+#   define YAL_SHED_INFO_DEPTH 50
+#endif // YAL_SHED_INFO_DEPTH
+#ifndef YAL_SHED_DEBUG_DEPTH
+#   define YAL_SHED_DEBUG_DEPTH 75
+#endif // YAL_SHED_DEBUG_DEPTH
+#ifndef YAL_SHED_WARNING_DEPTH
+#   define YAL_SHED_WARNING_DEPTH 90
+#endif // YAL_SHED_WARNING_DEPTH
+// how often the write latency and the throughput are sampled for the shedding(see session::shed_limits())
+#ifndef YAL_SHED_SAMPLE_INTERVAL
+#   define YAL_SHED_SAMPLE_INTERVAL 100 // in milliseconds
+#endif // YAL_SHED_SAMPLE_INTERVAL
+
+#ifndef YAL_BUDGET_DOWNGRADE_LEN
+#   define YAL_BUDGET_DOWNGRADE_LEN 64 // the data bytes kept by 'budget_downgrade'
+#endif // YAL_BUDGET_DOWNGRADE_LEN
+
+#ifndef YAL_STATS_SHARDS
+#   define YAL_STATS_SHARDS 8 // the writer threads are spread over them
+#endif // YAL_STATS_SHARDS
+
+#ifndef YAL_METRICS_INTERVAL
+#   define YAL_METRICS_INTERVAL 1000 // in milliseconds
+#endif // YAL_METRICS_INTERVAL
+
+#ifndef YAL_HOUSEKEEPING_INTERVAL
+#   define YAL_HOUSEKEEPING_INTERVAL 1000 // in milliseconds
+#endif // YAL_HOUSEKEEPING_INTERVAL
+
+#ifndef YAL_THROTTLE_SUMMARY_INTERVAL
+#   define YAL_THROTTLE_SUMMARY_INTERVAL 1000 // in milliseconds
+#endif // YAL_THROTTLE_SUMMARY_INTERVAL
+
 /***************************************************************************/
 
 namespace yal {
@@ -69,6 +119,21 @@ enum level {
     ,disable = 0
 };
 
+// what the writers do when the session buffer is full
+enum overflow_policy {
+     overflow_block         // wait for the free space(by default)
+    ,overflow_block_timeout // wait at most the timeout, then drop the record
+    ,overflow_drop_newest   // drop the record being written
+    ,overflow_drop_oldest   // drop the oldest buffered records
+    ,overflow_spill_to_file // append the record to '<name>.overflow' file
+};
+
+// what is done with the records above the session bytes per second budget
+enum budget_policy {
+     budget_drop      // drop the record
+    ,budget_downgrade // write only the first YAL_BUDGET_DOWNGRADE_LEN bytes of the data, if the budget allows
+};
+
 const char* level_str(const level lvl);
 char level_chr(const level lvl);
 
@@ -80,6 +145,320 @@ using process_buffer = std::function<
     std::pair<const char*, std::size_t>(const char*, std::size_t)
 >;
 
+// the volume number will be found by the session itself
+static const std::size_t unknown_volume_number = SIZE_MAX;
+
+// a volume file(or its index-file) of a session
+struct io_base {
+    virtual ~io_base() {}
+
+    // creates the file as '<fname>.active', close() renames it to 'fname'
+    virtual void create(const std::string &fname) = 0;
+    virtual void write(const void *ptr, const std::size_t size) = 0;
+    virtual void close() = 0;
+    virtual void fsync() = 0;
+    virtual std::size_t fpos() = 0;
+    virtual std::string name() const = 0;
+    // renames the created file keeping it open, like create('fname') would name it.
+    // returns false if it's not supported, then the file keeps its name.
+    virtual bool rename(const std::string &fname) { (void)fname; return false; }
+
+    // the plain or the compressed file, depending on 'compress' option
+    static io_base* create_default(std::uint32_t opts);
+    static std::string normalize_fname(const std::string &fname);
+};
+
+// creates the files of a session instead of io_base::create_default(), e.g. for
+// throttling or for the tests. it can be called by the background threads.
+using io_factory = std::function<io_base*(std::uint32_t opts)>;
+
+/***************************************************************************/
+
+// the static descriptor of a log statement. registered on its first execution,
+// and can be switched on/off at runtime regardless of the session level.
+struct callsite {
+    enum mode: std::uint8_t {
+         by_level // enabled if the session level allows it
+        ,enabled
+        ,disabled
+        ,unregistered // not executed yet
+    };
+
+    constexpr callsite(const char *file, std::size_t line, const char *func, level lvl, const char *args)
+        :file(file)
+        ,line(line)
+        ,func(func)
+        ,lvl(lvl)
+        ,args(args)
+        ,m_mode(unregistered)
+        ,m_hits(0)
+        ,m_bytes(0)
+    {}
+
+    bool enabled_for(level session_level) {
+        const std::uint8_t m = m_mode.load(std::memory_order_relaxed);
+        if ( m == by_level )
+            return session_level >= lvl;
+        if ( m == unregistered )
+            return enroll(session_level);
+
+        return m == enabled;
+    }
+    mode get_mode() const { return static_cast<mode>(m_mode.load(std::memory_order_relaxed)); }
+    void set_mode(mode m) { m_mode.store(m, std::memory_order_relaxed); }
+
+    // counts a record accepted by the session, 'bytes' is the size of its data
+    void account(std::size_t bytes) {
+        m_hits.fetch_add(1, std::memory_order_relaxed);
+        m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+    std::uint64_t hits() const { return m_hits.load(std::memory_order_relaxed); }
+    std::uint64_t bytes() const { return m_bytes.load(std::memory_order_relaxed); }
+
+    const char *const file;
+    const std::size_t line;
+    const char *const func;
+    const level lvl;
+    const char *const args; // the arguments as written, the format string first
+
+private:
+    // registers the callsite and applies the matching rules
+    bool enroll(level session_level);
+
+    std::atomic<std::uint8_t> m_mode;
+    std::atomic<std::uint64_t> m_hits;
+    std::atomic<std::uint64_t> m_bytes;
+};
+
+struct session;
+
+// the throttling state of a *_EVERY_N, *_RATE or *_SAMPLED log statement.
+// each check returns zero if the record is suppressed, otherwise one plus
+// the number of the records suppressed since the previous passed one.
+// the suppressed records not followed by a passed one for YAL_THROTTLE_SUMMARY_INTERVAL
+// milliseconds are reported by a separate record(see watch()).
+struct throttle {
+    constexpr throttle()
+        :m_count(0)
+        ,m_window(0)
+        ,m_suppressed(0)
+        ,m_passed(0)
+        ,m_watched(false)
+    {}
+
+    // the first record and then every n-th
+    std::size_t every_n(std::size_t n) {
+        const std::uint64_t cnt = m_count.fetch_add(1, std::memory_order_relaxed);
+
+        return (n > 1 && cnt % n) ? suppressed() : passed();
+    }
+    // at most 'per_sec' records per second
+    std::size_t rate(std::size_t per_sec) {
+        const std::uint64_t window = dtf::timestamp() / 1000000000ull;
+        std::uint64_t prev = m_window.load(std::memory_order_relaxed);
+        if ( prev != window && m_window.compare_exchange_strong(prev, window, std::memory_order_relaxed) )
+            m_count.store(0, std::memory_order_relaxed);
+
+        return m_count.fetch_add(1, std::memory_order_relaxed) < per_sec ? passed() : suppressed();
+    }
+    // each record with the probability 'prob'
+    std::size_t sampled(double prob) {
+        // xorshift64*, seeded by the address of the state
+        static thread_local std::uint64_t state = reinterpret_cast<std::uintptr_t>(&state) | 1u;
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        const double r = static_cast<double>((state * 2685821657736338717ull) >> 11) / 9007199254740992.0;
+
+        return r < prob ? passed() : suppressed();
+    }
+
+    // called for a suppressed record. the first call hands the throttle to the
+    // background thread which reports the suppressed records to 'log'
+    void watch(const std::shared_ptr<session> &log, const callsite &cs) {
+        if ( !m_watched.load(std::memory_order_relaxed) )
+            enroll(log, cs);
+    }
+    // the number of the passed records
+    std::uint64_t passed_records() const { return m_passed.load(std::memory_order_relaxed); }
+    // returns the number of the records suppressed since the last check or passed record
+    std::uint64_t take_suppressed() { return m_suppressed.exchange(0, std::memory_order_relaxed); }
+
+private:
+    std::size_t passed() {
+        m_passed.fetch_add(1, std::memory_order_relaxed);
+        return 1 + static_cast<std::size_t>(take_suppressed());
+    }
+    std::size_t suppressed() { m_suppressed.fetch_add(1, std::memory_order_relaxed); return 0; }
+
+    void enroll(const std::shared_ptr<session> &log, const callsite &cs);
+
+    std::atomic<std::uint64_t> m_count;
+    std::atomic<std::uint64_t> m_window; // the current second, for rate()
+    std::atomic<std::uint64_t> m_suppressed;
+    std::atomic<std::uint64_t> m_passed;
+    std::atomic<bool> m_watched;
+};
+
+// selects the callsites. the empty strings and zero line match any callsite.
+// 'file' is a glob('*' and '?') matched against the full and the short file name.
+struct callsite_filter {
+    callsite_filter(
+         std::string file = std::string()
+        ,std::string func = std::string()
+        ,std::size_t line = 0
+    )
+        :file(std::move(file))
+        ,func(std::move(func))
+        ,line(line)
+    {}
+
+    bool match(const callsite &cs) const;
+
+    std::string file;
+    std::string func;
+    std::size_t line;
+};
+
+struct session_params {
+    session_params(
+         std::string name
+        ,std::size_t volume_size = UINT_MAX
+        ,std::uint32_t opts = options::sec_res
+        ,process_buffer proc = process_buffer()
+        ,io_factory io = io_factory()
+    )
+        :name(std::move(name))
+        ,volume_size(volume_size)
+        ,opts(opts)
+        ,proc(std::move(proc))
+        ,io(std::move(io))
+    {}
+
+    std::string name;
+    std::size_t volume_size;
+    std::uint32_t opts;
+    process_buffer proc;
+    io_factory io;
+};
+
+// zero means unlimited. the active volume is never removed.
+struct retention_policy {
+    retention_policy(
+         std::size_t max_bytes = 0
+        ,std::size_t max_volumes = 0
+        ,std::size_t max_age = 0
+    )
+        :max_bytes(max_bytes)
+        ,max_volumes(max_volumes)
+        ,max_age(max_age)
+    {}
+
+    std::size_t max_bytes;   // total size of the closed volumes
+    std::size_t max_volumes; // number of the closed volumes
+    std::size_t max_age;     // in seconds
+};
+
+// the HDR-like histogram: the values are grouped by the power of two,
+// and each group is split into 'sub_buckets' linear buckets(the error is below 25%).
+struct latency_histogram {
+    enum: std::size_t {
+         sub_buckets = 4
+        ,max_power   = 40 // ~18 minutes in nanoseconds, the larger values go to the last bucket
+        ,buckets     = (max_power-1) * sub_buckets
+    };
+
+    latency_histogram()
+        :counts()
+        ,total(0)
+        ,sum(0)
+        ,max(0)
+    {}
+
+    static std::size_t bucket(std::uint64_t value) {
+        if ( value < sub_buckets )
+            return static_cast<std::size_t>(value);
+
+        std::size_t power = 0;
+        for ( std::uint64_t v = value; v >>= 1; ) {
+            ++power;
+        }
+        if ( power >= max_power )
+            return buckets-1;
+
+        return (power-1) * sub_buckets + static_cast<std::size_t>((value >> (power-2)) & (sub_buckets-1));
+    }
+    // the smallest value of the next bucket
+    static std::uint64_t upper_bound(std::size_t idx) {
+        ++idx;
+        if ( idx < sub_buckets )
+            return idx;
+
+        return static_cast<std::uint64_t>(sub_buckets + idx % sub_buckets) << (idx / sub_buckets - 1);
+    }
+
+    // 'q' is in the range [0, 1]. the result is the upper bound of the bucket, but not above 'max'
+    std::uint64_t percentile(double q) const {
+        const std::uint64_t rank = static_cast<std::uint64_t>(q * static_cast<double>(total) + 0.5);
+        std::uint64_t seen = 0;
+        for ( std::size_t idx = 0; idx < buckets; ++idx ) {
+            seen += counts[idx];
+            if ( seen && seen >= rank )
+                return upper_bound(idx) < max ? upper_bound(idx) : max;
+        }
+
+        return max;
+    }
+    std::uint64_t mean() const { return total ? sum / total : 0; }
+
+    std::uint64_t counts[buckets];
+    std::uint64_t total;
+    std::uint64_t sum;
+    std::uint64_t max;
+};
+
+// the counters of a session, since its creation
+struct session_stats {
+    session_stats()
+        :name()
+        ,records()
+        ,bytes()
+        ,rotations(0)
+        ,fsyncs(0)
+        ,errors(0)
+        ,dropped(0)
+        ,blocked(0)
+        ,spilled(0)
+        ,shed(0)
+        ,late(0)
+        ,over_budget(0)
+        ,downgraded(0)
+        ,queue_depth(0)
+        ,latency()
+    {}
+
+    std::uint64_t total_records() const { std::uint64_t r = 0; for ( auto it: records ) r += it; return r; }
+    std::uint64_t total_bytes() const { std::uint64_t r = 0; for ( auto it: bytes ) r += it; return r; }
+
+    std::string   name;
+    // by level, accepted into the buffer: not shed, dropped nor spilled when written.
+    // the records discarded later(overflow_drop_oldest, the budget) are counted by 'dropped' and 'over_budget'
+    std::uint64_t records[info+1];
+    std::uint64_t bytes[info+1];   // by level, the formatted records
+    std::uint64_t rotations;
+    std::uint64_t fsyncs;
+    std::uint64_t errors;          // of the volume writes
+    std::uint64_t dropped;         // see 'session::dropped_records()' and the next ones
+    std::uint64_t blocked;
+    std::uint64_t spilled;
+    std::uint64_t shed;
+    std::uint64_t late;
+    std::uint64_t over_budget;
+    std::uint64_t downgraded;
+    std::size_t   queue_depth;     // the bytes buffered but not written yet
+    latency_histogram latency;     // of the session writes, in nanoseconds
+};
+
 struct session {
     session(const session &) = delete;
     session& operator=(const session &) = delete;
@@ -92,6 +471,8 @@ struct session {
         ,std::size_t volume_size
         ,std::size_t opts
         ,process_buffer broc
+        ,std::size_t volume_number = unknown_volume_number
+        ,io_factory io = io_factory()
     );
     virtual ~session();
 
@@ -99,12 +480,46 @@ struct session {
     std::size_t flags() const;
     std::size_t volume_size() const;
 
+    // rotate the volumes every 'secs' seconds in addition to 'volume_size'. zero disables.
+    std::size_t rotation_interval() const;
+    void rotation_interval(std::size_t secs);
+
+    // with 'reorder_records' the records are written in timestamp order if they arrive
+    // within 'usecs' microseconds. the later ones are written as is and counted.
+    std::size_t reorder_window() const;
+    void reorder_window(std::size_t usecs);
+    std::uint64_t late_records() const;
+
+    // with 'shed_under_backlog', the number of the records dropped because of the backlog
+    std::uint64_t shed_records() const;
+    // with 'shed_under_backlog', also shed when the p99 write latency or the written bytes
+    // per second exceed the limits. the limit counts as the YAL_SHED_INFO_DEPTH buffer depth,
+    // twice the limit as twice that depth, and so on. zero disables the limit.
+    void shed_limits(std::size_t p99_usecs, std::size_t bytes_per_sec);
+
+    // 'timeout' is in milliseconds, for 'overflow_block_timeout'
+    void overflow(overflow_policy policy, std::size_t timeout = 0);
+    overflow_policy overflow() const;
+    std::uint64_t dropped_records() const; // by the overflow policy
+    std::uint64_t blocked_records() const; // the writers waited for the space
+    std::uint64_t spilled_records() const;
+
+    // the token bucket limiting the bytes written to the volumes. zero 'bytes_per_sec' disables.
+    void budget(std::size_t bytes_per_sec, std::size_t burst, budget_policy policy = budget_drop);
+    std::uint64_t over_budget_records() const; // dropped
+    std::uint64_t downgraded_records() const;
+
+    // the counters are sharded by the writer threads, so it's a sum of the shards
+    session_stats stats() const;
+
     void to_term(const bool ok, const std::string &pref);
 
     void set_level(const level lvl);
-    yal::level get_level() const;
+    // inline, because it's checked by every log statement
+    yal::level get_level() const { return static_cast<level>(m_level.load(std::memory_order_relaxed)); }
 
-    void write(
+    // returns false if the record was shed, or dropped or spilled by the overflow policy
+    bool write(
          const char *fileline
         ,const std::size_t fileline_len
         ,const char *sfileline
@@ -118,9 +533,22 @@ struct session {
     );
     void flush();
 
+    // the session's own policy, applied in addition to the global one.
+    // the oldest volumes are removed in the background
+    void retention(const retention_policy &policy);
+
 private:
+    friend struct session_manager; // the global writes share the record between the sessions
+    friend struct throttle_watcher; // defers the errors of its writes to the session writers
+
     struct impl;
     std::unique_ptr<impl> pimpl;
+
+    // on its own cache line, so the log statements of the other threads
+    // don't share it with the data written by them
+    char m_level_pad0[64];
+    std::atomic<std::uint8_t> m_level;
+    char m_level_pad1[64-sizeof(std::atomic<std::uint8_t>)];
 }; // struct session
 
 /***************************************************************************/
@@ -138,7 +566,12 @@ struct session_manager {
     void root_path(const std::string& path);
 
     std::shared_ptr<session>
-    create(const std::string &name, std::size_t volume_size, uint32_t opts, process_buffer proc);
+    create(const std::string &name, std::size_t volume_size, uint32_t opts, process_buffer proc, io_factory io = io_factory());
+
+    // reads each distinct directory only once for all the sessions.
+    // the sessions are constructed using 'threads' threads.
+    std::vector<std::shared_ptr<session>>
+    create_many(const std::vector<session_params> &params, std::size_t threads = 1);
 
     void write(
          const char *fileline
@@ -158,6 +591,21 @@ struct session_manager {
 
     void flush();
 
+    // the policy for all the sessions together, whether they have their own policy or not
+    void retention(const retention_policy &policy);
+    retention_policy retention() const;
+
+    // of all the sessions, sorted by name
+    std::vector<session_stats> stats() const;
+
+    // starts the thread writing the metrics of the sessions in the Prometheus text format
+    // every 'interval' milliseconds to the file 'target', or to 'unix:<path>' socket
+    // for the connecting clients. the empty 'target' stops it.
+    void export_metrics(const std::string &target, std::size_t interval = YAL_METRICS_INTERVAL);
+
+    // see logger::report_callsites()
+    void report_callsites(const std::shared_ptr<session> &log, std::size_t top, std::size_t interval);
+
 private:
     struct impl;
     std::unique_ptr<impl> pimpl;
@@ -170,6 +618,14 @@ private:
 /***************************************************************************/
 
 using session = std::shared_ptr<detail::session>;
+using session_params = detail::session_params;
+using io_base = detail::io_base;
+using io_factory = detail::io_factory;
+using retention_policy = detail::retention_policy;
+using callsite = detail::callsite;
+using callsite_filter = detail::callsite_filter;
+using latency_histogram = detail::latency_histogram;
+using session_stats = detail::session_stats;
 
 struct logger {
     logger(const logger &) = delete;
@@ -185,6 +641,12 @@ struct logger {
         ,std::size_t volume_size = UINT_MAX
         ,std::uint32_t opts = options::sec_res
         ,detail::process_buffer proc = detail::process_buffer()
+        ,detail::io_factory io = detail::io_factory()
+    );
+
+    static std::vector<yal::session> create_many(
+         const std::vector<session_params> &params
+        ,std::size_t threads = 1
     );
 
     static yal::session get(const std::string &name);
@@ -204,8 +666,32 @@ struct logger {
 
     static void flush();
 
+    static void retention(const retention_policy &policy);
+    static retention_policy retention();
+
+    static std::vector<session_stats> stats();
+    static void export_metrics(const std::string &target, std::size_t interval = YAL_METRICS_INTERVAL);
+
+    // sets the mode of the matching callsites and returns their number.
+    // the callsites which are not executed yet get the mode on their first execution.
+    static std::size_t callsites_mode(const callsite_filter &filter, callsite::mode mode);
+    static std::vector<const callsite*> callsites();
+    // the 'top' callsites with the most bytes written
+    static std::vector<const callsite*> top_callsites(std::size_t top);
+    // writes the 'top' callsites with the most bytes written during the last 'interval'
+    // seconds to 'log' every 'interval' seconds. zero 'top' or 'interval' stops it.
+    static void report_callsites(const yal::session &log, std::size_t top, std::size_t interval);
+
+    // the most verbose level of all the sessions. the global records
+    // of the less important levels are not even formatted.
+    static level max_level() { return static_cast<level>(s_max_level.load(std::memory_order_relaxed)); }
+
 private:
+    friend struct detail::session_manager; // updates 's_max_level'
+
     static detail::session_manager* instance();
+
+    static std::atomic<std::uint8_t> s_max_level;
 }; // struct logger
 
 /***************************************************************************/
@@ -269,6 +755,8 @@ constexpr std::size_t __yal_strlen(const char *s, std::size_t len = 0) {
         :var(::yal::logger::create(__VA_ARGS__))
 #   define YAL_SESSION_CREATE4(var, ...) \
         ,var(::yal::logger::create(__VA_ARGS__))
+#   define YAL_SESSION_CREATE_MANY(var, ...) \
+        std::vector<::yal::session> var = ::yal::logger::create_many(__VA_ARGS__)
 
 #   define YAL_SESSION_GET(name) \
         ::yal::logger::get(name)
@@ -282,12 +770,52 @@ constexpr std::size_t __yal_strlen(const char *s, std::size_t len = 0) {
         log->flags()
 #   define YAL_SESSION_GET_VOLUME_SIZE(log) \
         log->volume_size()
+#   define YAL_SESSION_GET_ROTATION_INTERVAL(log) \
+        log->rotation_interval()
+#   define YAL_SESSION_GET_REORDER_WINDOW(log) \
+        log->reorder_window()
+#   define YAL_SESSION_GET_LATE_RECORDS(log) \
+        log->late_records()
+#   define YAL_SESSION_GET_SHED_RECORDS(log) \
+        log->shed_records()
+#   define YAL_SESSION_GET_OVERFLOW(log) \
+        log->overflow()
+#   define YAL_SESSION_GET_DROPPED_RECORDS(log) \
+        log->dropped_records()
+#   define YAL_SESSION_GET_BLOCKED_RECORDS(log) \
+        log->blocked_records()
+#   define YAL_SESSION_GET_SPILLED_RECORDS(log) \
+        log->spilled_records()
+#   define YAL_SESSION_GET_OVER_BUDGET_RECORDS(log) \
+        log->over_budget_records()
+#   define YAL_SESSION_GET_DOWNGRADED_RECORDS(log) \
+        log->downgraded_records()
+#   define YAL_SESSION_GET_STATS(log) \
+        log->stats()
+#   define YAL_GET_STATS() \
+        ::yal::logger::stats()
+#   define YAL_EXPORT_METRICS(...) \
+        ::yal::logger::export_metrics(__VA_ARGS__)
 
 #   define YAL_SESSION_FLUSH(log) \
         log->flush()
 
 #   define YAL_SESSION_SET_LEVEL(log, lvl) \
         log->set_level((lvl))
+#   define YAL_SESSION_SET_ROTATION_INTERVAL(log, secs) \
+        log->rotation_interval((secs))
+#   define YAL_SESSION_SET_REORDER_WINDOW(log, usecs) \
+        log->reorder_window((usecs))
+#   define YAL_SESSION_SET_OVERFLOW(log, ...) \
+        log->overflow(__VA_ARGS__)
+#   define YAL_SESSION_SET_BUDGET(log, ...) \
+        log->budget(__VA_ARGS__)
+#   define YAL_SESSION_SET_SHED_LIMITS(log, p99_usecs, bytes_per_sec) \
+        log->shed_limits((p99_usecs), (bytes_per_sec))
+#   define YAL_SESSION_SET_RETENTION(log, ...) \
+        log->retention(::yal::retention_policy(__VA_ARGS__))
+#   define YAL_SET_RETENTION(...) \
+        ::yal::logger::retention(::yal::retention_policy(__VA_ARGS__))
 #   define YAL_SESSION_SET_BUFFER(log, size) \
         log->set_buffer((size))
 #   define YAL_SESSION_SET_UNBUFFERED(log) \
@@ -295,13 +823,89 @@ constexpr std::size_t __yal_strlen(const char *s, std::size_t len = 0) {
 #   define YAL_SESSION_TO_TERM(log, flag, pref) \
         log->to_term((flag), (pref))
 
+#   define YAL_CALLSITES_ENABLE(...) \
+        ::yal::logger::callsites_mode(::yal::callsite_filter(__VA_ARGS__), ::yal::callsite::enabled)
+#   define YAL_CALLSITES_DISABLE(...) \
+        ::yal::logger::callsites_mode(::yal::callsite_filter(__VA_ARGS__), ::yal::callsite::disabled)
+#   define YAL_CALLSITES_RESET(...) \
+        ::yal::logger::callsites_mode(::yal::callsite_filter(__VA_ARGS__), ::yal::callsite::by_level)
+#   define YAL_CALLSITES_TOP(top) \
+        ::yal::logger::top_callsites(top)
+#   define YAL_CALLSITES_REPORT(log, top, interval) \
+        ::yal::logger::report_callsites(log, (top), (interval))
+
+// 'written' is set to false if the record was shed or dropped
+#   define __YAL_LOG_WRITE(log, errlvl, data, written) \
+        do { \
+            constexpr const char *flbuf = __FILE__ ":" __YAL_STRINGIZE(__LINE__); \
+            constexpr std::size_t fllen = __yal_strlen(flbuf); \
+            constexpr const char *sfl = __yal_strrchr(flbuf+fllen, fllen); \
+            written = log->write( \
+                 flbuf \
+                ,fllen \
+                ,sfl \
+                ,fllen-(sfl-flbuf) \
+                ,__FUNCTION__ \
+                ,sizeof(__FUNCTION__)-1 \
+                ,__PRETTY_FUNCTION__ \
+                ,sizeof(__PRETTY_FUNCTION__)-1 \
+                ,data \
+                ,::yal::level::errlvl \
+            ); \
+        } while(false)
+// writes the data, and counts it by the callsite declared by __YAL_DECLARE_CALLSITE
+// if the session accepted it
+#   define __YAL_LOG_COUNTED_DATA(log, errlvl, data) \
+        do { \
+            bool __yal_written = false; \
+            __YAL_LOG_WRITE(log, errlvl, data, __yal_written); \
+            if ( __yal_written ) \
+                __yal_callsite.account(data.size()); \
+        } while(false)
+// formats the data, and writes it by __YAL_LOG_COUNTED_DATA
+#   define __YAL_LOG_COUNTED_WRITE(log, errlvl, ...) \
+        do { \
+            const std::string __yal_data = ::fmt::format(__VA_ARGS__); \
+            __YAL_LOG_COUNTED_DATA(log, errlvl, __yal_data); \
+        } while(false)
+#   define __YAL_DECLARE_CALLSITE(errlvl, ...) \
+        static ::yal::detail::callsite __yal_callsite( \
+             __FILE__ \
+            ,__LINE__ \
+            ,__FUNCTION__ \
+            ,::yal::level::errlvl \
+            ,#__VA_ARGS__ \
+        )
 #   define __YAL_LOG_IMPL(log, errlvl, ...) \
         do { \
-            if ( log->get_level() >= ::yal::level::errlvl ) { \
+            __YAL_DECLARE_CALLSITE(errlvl, __VA_ARGS__); \
+            if ( __yal_callsite.enabled_for(log->get_level()) ) { \
+                __YAL_LOG_COUNTED_WRITE(log, errlvl, __VA_ARGS__); \
+            } \
+        } while(false)
+// 'check' is a call of a ::yal::detail::throttle member
+#   define __YAL_LOG_THROTTLED_IMPL(log, errlvl, check, ...) \
+        do { \
+            __YAL_DECLARE_CALLSITE(errlvl, __VA_ARGS__); \
+            static ::yal::detail::throttle __yal_throttle; \
+            if ( __yal_callsite.enabled_for(log->get_level()) ) { \
+                if ( const std::size_t __yal_passed = __yal_throttle.check ) { \
+                    std::string __yal_folded = ::fmt::format(__VA_ARGS__); \
+                    if ( __yal_passed > 1 ) \
+                        __yal_folded += ::fmt::format(" (suppressed {} records)", __yal_passed-1); \
+                    __YAL_LOG_COUNTED_DATA(log, errlvl, __yal_folded); \
+                } else { \
+                    __yal_throttle.watch(log, __yal_callsite); \
+                } \
+            } \
+        } while(false)
+#   define __YAL_GLOBAL_LOG_IMPL(errlvl, ...) \
+        do { \
+            if ( ::yal::logger::max_level() >= ::yal::level::errlvl ) { \
                 constexpr const char *flbuf = __FILE__ ":" __YAL_STRINGIZE(__LINE__); \
                 constexpr std::size_t fllen = __yal_strlen(flbuf); \
                 constexpr const char *sfl = __yal_strrchr(flbuf+fllen, fllen); \
-                log->write( \
+                ::yal::logger::write( \
                      flbuf \
                     ,fllen \
                     ,sfl \
@@ -315,33 +919,21 @@ constexpr std::size_t __yal_strlen(const char *s, std::size_t len = 0) {
                 ); \
             } \
         } while(false)
-#   define __YAL_GLOBAL_LOG_IMPL(errlvl, ...) \
-        do { \
-            constexpr const char *flbuf = __FILE__ ":" __YAL_STRINGIZE(__LINE__); \
-            constexpr std::size_t fllen = __yal_strlen(flbuf); \
-            constexpr const char *sfl = __yal_strrchr(flbuf+fllen, fllen); \
-            ::yal::logger::write( \
-                 flbuf \
-                ,fllen \
-                ,sfl \
-                ,sfl-flbuf \
-                ,__FUNCTION__ \
-                ,sizeof(__FUNCTION__)-1 \
-                ,__PRETTY_FUNCTION__ \
-                ,sizeof(__PRETTY_FUNCTION__)-1 \
-                ,::fmt::format(__VA_ARGS__) \
-                ,::yal::level::errlvl \
-            ); \
-        } while(false)
 
 #   ifndef YAL_DISABLE_LOG_ERROR
 #       define YAL_LOG_ERROR(log, ...) __YAL_LOG_IMPL(log, error, __VA_ARGS__)
 #       define YAL_LOG_ERROR_IF(log, cond, ...) if ( (cond) ) YAL_LOG_ERROR(log, __VA_ARGS__)
+#       define YAL_LOG_ERROR_EVERY_N(log, n, ...) __YAL_LOG_THROTTLED_IMPL(log, error, every_n((n)), __VA_ARGS__)
+#       define YAL_LOG_ERROR_RATE(log, per_sec, ...) __YAL_LOG_THROTTLED_IMPL(log, error, rate((per_sec)), __VA_ARGS__)
+#       define YAL_LOG_ERROR_SAMPLED(log, prob, ...) __YAL_LOG_THROTTLED_IMPL(log, error, sampled((prob)), __VA_ARGS__)
 #       define YAL_GLOBAL_LOG_ERROR(...) __YAL_GLOBAL_LOG_IMPL(error, __VA_ARGS__)
 #       define YAL_GLOBAL_LOG_ERROR_IF(cond, ...) if ( (cond) ) YAL_GLOBAL_LOG_ERROR(__VA_ARGS__)
 #   else // YAL_DISABLE_LOG_ERROR
 #       define YAL_LOG_ERROR(log, ...) do {} while(false)
 #       define YAL_LOG_ERROR_IF(log, cond, ...) do {} while(false)
+#       define YAL_LOG_ERROR_EVERY_N(log, n, ...) do {} while(false)
+#       define YAL_LOG_ERROR_RATE(log, per_sec, ...) do {} while(false)
+#       define YAL_LOG_ERROR_SAMPLED(log, prob, ...) do {} while(false)
 #       define YAL_GLOBAL_LOG_ERROR(...) do {} while(false)
 #       define YAL_GLOBAL_LOG_ERROR_IF(cond, ...) do {} while(false)
 #   endif // YAL_DISABLE_LOG_ERROR
@@ -349,11 +941,17 @@ constexpr std::size_t __yal_strlen(const char *s, std::size_t len = 0) {
 #   ifndef YAL_DISABLE_LOG_WARNING
 #       define YAL_LOG_WARNING(log, ...) __YAL_LOG_IMPL(log, warning, __VA_ARGS__)
 #       define YAL_LOG_WARNING_IF(log, cond, ...) if ( (cond) ) YAL_LOG_WARNING(log, __VA_ARGS__)
+#       define YAL_LOG_WARNING_EVERY_N(log, n, ...) __YAL_LOG_THROTTLED_IMPL(log, warning, every_n((n)), __VA_ARGS__)
+#       define YAL_LOG_WARNING_RATE(log, per_sec, ...) __YAL_LOG_THROTTLED_IMPL(log, warning, rate((per_sec)), __VA_ARGS__)
+#       define YAL_LOG_WARNING_SAMPLED(log, prob, ...) __YAL_LOG_THROTTLED_IMPL(log, warning, sampled((prob)), __VA_ARGS__)
 #       define YAL_GLOBAL_LOG_WARNING(...) __YAL_GLOBAL_LOG_IMPL(warning, __VA_ARGS__)
 #       define YAL_GLOBAL_LOG_WARNING_IF(cond, ...) if ( (cond) ) YAL_GLOBAL_LOG_WARNING(__VA_ARGS__)
 #   else // YAL_DISABLE_LOG_WARNING
 #       define YAL_LOG_WARNING(log, ...) do {} while(false)
 #       define YAL_LOG_WARNING_IF(log, cond, ...) do {} while(false)
+#       define YAL_LOG_WARNING_EVERY_N(log, n, ...) do {} while(false)
+#       define YAL_LOG_WARNING_RATE(log, per_sec, ...) do {} while(false)
+#       define YAL_LOG_WARNING_SAMPLED(log, prob, ...) do {} while(false)
 #       define YAL_GLOBAL_LOG_WARNING(...) do {} while(false)
 #       define YAL_GLOBAL_LOG_WARNING_IF(cond, ...) do {} while(false)
 #   endif // YAL_DISABLE_LOG_WARNING
@@ -361,11 +959,17 @@ constexpr std::size_t __yal_strlen(const char *s, std::size_t len = 0) {
 #   ifndef YAL_DISABLE_LOG_DEBUG
 #       define YAL_LOG_DEBUG(log, ...) __YAL_LOG_IMPL(log, debug, __VA_ARGS__)
 #       define YAL_LOG_DEBUG_IF(log, cond, ...) if ( (cond) ) YAL_LOG_DEBUG(log, __VA_ARGS__)
+#       define YAL_LOG_DEBUG_EVERY_N(log, n, ...) __YAL_LOG_THROTTLED_IMPL(log, debug, every_n((n)), __VA_ARGS__)
+#       define YAL_LOG_DEBUG_RATE(log, per_sec, ...) __YAL_LOG_THROTTLED_IMPL(log, debug, rate((per_sec)), __VA_ARGS__)
+#       define YAL_LOG_DEBUG_SAMPLED(log, prob, ...) __YAL_LOG_THROTTLED_IMPL(log, debug, sampled((prob)), __VA_ARGS__)
 #       define YAL_GLOBAL_LOG_DEBUG(...) __YAL_GLOBAL_LOG_IMPL(debug, __VA_ARGS__)
 #       define YAL_GLOBAL_LOG_DEBUG_IF(cond, ...) if ( (cond) ) YAL_GLOBAL_LOG_DEBUG(__VA_ARGS__)
 #   else // YAL_DISABLE_LOG_DEBUG
 #       define YAL_LOG_DEBUG(log, ...) do {} while(false)
 #       define YAL_LOG_DEBUG_IF(log, cond, ...) do {} while(false)
+#       define YAL_LOG_DEBUG_EVERY_N(log, n, ...) do {} while(false)
+#       define YAL_LOG_DEBUG_RATE(log, per_sec, ...) do {} while(false)
+#       define YAL_LOG_DEBUG_SAMPLED(log, prob, ...) do {} while(false)
 #       define YAL_GLOBAL_LOG_DEBUG(...) do {} while(false)
 #       define YAL_GLOBAL_LOG_DEBUG_IF(cond, ...) do {} while(false)
 #   endif // YAL_DISABLE_LOG_DEBUG
@@ -373,11 +977,17 @@ constexpr std::size_t __yal_strlen(const char *s, std::size_t len = 0) {
 #   ifndef YAL_DISABLE_LOG_INFO
 #       define YAL_LOG_INFO(log, ...) __YAL_LOG_IMPL(log, info, __VA_ARGS__)
 #       define YAL_LOG_INFO_IF(log, cond, ...) if ( (cond) ) YAL_LOG_INFO(log, __VA_ARGS__)
+#       define YAL_LOG_INFO_EVERY_N(log, n, ...) __YAL_LOG_THROTTLED_IMPL(log, info, every_n((n)), __VA_ARGS__)
+#       define YAL_LOG_INFO_RATE(log, per_sec, ...) __YAL_LOG_THROTTLED_IMPL(log, info, rate((per_sec)), __VA_ARGS__)
+#       define YAL_LOG_INFO_SAMPLED(log, prob, ...) __YAL_LOG_THROTTLED_IMPL(log, info, sampled((prob)), __VA_ARGS__)
 #       define YAL_GLOBAL_LOG_INFO(...) __YAL_GLOBAL_LOG_IMPL(info, __VA_ARGS__)
 #       define YAL_GLOBAL_LOG_INFO_IF(cond, ...) if ( (cond) ) YAL_GLOBAL_LOG_INFO(__VA_ARGS__)
 #   else // YAL_DISABLE_LOG_INFO
 #       define YAL_LOG_INFO(log, ...) do {} while(false)
 #       define YAL_LOG_INFO_IF(log, cond, ...) do {} while(false)
+#       define YAL_LOG_INFO_EVERY_N(log, n, ...) do {} while(false)
+#       define YAL_LOG_INFO_RATE(log, per_sec, ...) do {} while(false)
+#       define YAL_LOG_INFO_SAMPLED(log, prob, ...) do {} while(false)
 #       define YAL_GLOBAL_LOG_INFO(...) do {} while(false)
 #       define YAL_GLOBAL_LOG_INFO_IF(cond, ...) do {} while(false)
 #   endif // YAL_DISABLE_LOG_INFO
@@ -399,6 +1009,7 @@ constexpr std::size_t __yal_strlen(const char *s, std::size_t len = 0) {
 #   define YAL_SESSION_CREATE2(var, ...)
 #   define YAL_SESSION_CREATE3(var, ...)
 #   define YAL_SESSION_CREATE4(var, ...)
+#   define YAL_SESSION_CREATE_MANY(var, ...)
 
 #   define YAL_SESSION_GET(name)
 #   define YAL_SESSION_GET2(var, name)
@@ -407,28 +1018,66 @@ constexpr std::size_t __yal_strlen(const char *s, std::size_t len = 0) {
 
 #   define YAL_SESSION_GET_FLAGS(log)
 #   define YAL_SESSION_GET_VOLUME_SIZE(log)
+#   define YAL_SESSION_GET_ROTATION_INTERVAL(log)
+#   define YAL_SESSION_GET_REORDER_WINDOW(log)
+#   define YAL_SESSION_GET_LATE_RECORDS(log)
+#   define YAL_SESSION_GET_SHED_RECORDS(log)
+#   define YAL_SESSION_GET_OVERFLOW(log)
+#   define YAL_SESSION_GET_DROPPED_RECORDS(log)
+#   define YAL_SESSION_GET_BLOCKED_RECORDS(log)
+#   define YAL_SESSION_GET_SPILLED_RECORDS(log)
+#   define YAL_SESSION_GET_OVER_BUDGET_RECORDS(log)
+#   define YAL_SESSION_GET_DOWNGRADED_RECORDS(log)
+#   define YAL_SESSION_GET_STATS(log)
+#   define YAL_GET_STATS()
+#   define YAL_EXPORT_METRICS(...)
 
 #   define YAL_SESSION_FLUSH(log)
 
 #   define YAL_SESSION_SET_LEVEL(log, lvl)
+#   define YAL_SESSION_SET_ROTATION_INTERVAL(log, secs)
+#   define YAL_SESSION_SET_REORDER_WINDOW(log, usecs)
+#   define YAL_SESSION_SET_OVERFLOW(log, ...)
+#   define YAL_SESSION_SET_BUDGET(log, ...)
+#   define YAL_SESSION_SET_SHED_LIMITS(log, p99_usecs, bytes_per_sec)
+#   define YAL_SESSION_SET_RETENTION(log, ...)
+#   define YAL_SET_RETENTION(...)
 #   define YAL_SESSION_SET_BUFFER(log, size)
 #   define YAL_SESSION_SET_UNBUFFERED(log)
 #   define YAL_SESSION_TO_TERM(log, flag, pref)
 
+#   define YAL_CALLSITES_ENABLE(...)
+#   define YAL_CALLSITES_DISABLE(...)
+#   define YAL_CALLSITES_RESET(...)
+#   define YAL_CALLSITES_TOP(top)
+#   define YAL_CALLSITES_REPORT(log, top, interval)
+
 #   define YAL_LOG_ERROR(log, ...) do {} while(false)
 #   define YAL_LOG_ERROR_IF(log, cond, ...) do {} while(false)
+#   define YAL_LOG_ERROR_EVERY_N(log, n, ...) do {} while(false)
+#   define YAL_LOG_ERROR_RATE(log, per_sec, ...) do {} while(false)
+#   define YAL_LOG_ERROR_SAMPLED(log, prob, ...) do {} while(false)
 #   define YAL_GLOBAL_LOG_ERROR(...) do {} while(false)
 #   define YAL_GLOBAL_LOG_ERROR_IF(cond, ...) do {} while(false)
 #   define YAL_LOG_WARNING(log, ...) do {} while(false)
 #   define YAL_LOG_WARNING_IF(log, cond, ...) do {} while(false)
+#   define YAL_LOG_WARNING_EVERY_N(log, n, ...) do {} while(false)
+#   define YAL_LOG_WARNING_RATE(log, per_sec, ...) do {} while(false)
+#   define YAL_LOG_WARNING_SAMPLED(log, prob, ...) do {} while(false)
 #   define YAL_GLOBAL_LOG_WARNING(...) do {} while(false)
 #   define YAL_GLOBAL_LOG_WARNING_IF(cond, ...) do {} while(false)
 #   define YAL_LOG_DEBUG(log, ...) do {} while(false)
 #   define YAL_LOG_DEBUG_IF(log, cond, ...) do {} while(false)
+#   define YAL_LOG_DEBUG_EVERY_N(log, n, ...) do {} while(false)
+#   define YAL_LOG_DEBUG_RATE(log, per_sec, ...) do {} while(false)
+#   define YAL_LOG_DEBUG_SAMPLED(log, prob, ...) do {} while(false)
 #   define YAL_GLOBAL_LOG_DEBUG(...) do {} while(false)
 #   define YAL_GLOBAL_LOG_DEBUG_IF(cond, ...) do {} while(false)
 #   define YAL_LOG_INFO(log, ...) do {} while(false)
 #   define YAL_LOG_INFO_IF(log, cond, ...) do {} while(false)
+#   define YAL_LOG_INFO_EVERY_N(log, n, ...) do {} while(false)
+#   define YAL_LOG_INFO_RATE(log, per_sec, ...) do {} while(false)
+#   define YAL_LOG_INFO_SAMPLED(log, prob, ...) do {} while(false)
 #   define YAL_GLOBAL_LOG_INFO(...) do {} while(false)
 #   define YAL_GLOBAL_LOG_INFO_IF(cond, ...) do {} while(false)
 #endif // YAL_DISABLE_LOGGING
@@ -0,0 +1,148 @@
+
+// Copyright (c) 2013-2020 niXman (i dotty nixman doggy gmail dotty com)
+// All rights reserved.
+//
+// This file is part of YAL(https://github.com/niXman/yal) project.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//   Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+//
+//   Redistributions in binary form must reproduce the above copyright notice, this
+//   list of conditions and the following disclaimer in the documentation and/or
+//   other materials provided with the distribution.
+//
+//   Neither the name of the {organization} nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <yal/summary.hpp>
+#include <yal/files.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <algorithm>
+
+namespace yal {
+
+/**************************************************************************/
+
+namespace {
+
+struct summary_field {
+	const char *name;
+	std::uint64_t volume_summary::*field;
+};
+
+const summary_field summary_fields[] = {
+	 {"first_ts"      , &volume_summary::first_ts}
+	,{"last_ts"       , &volume_summary::last_ts}
+	,{"records"       , &volume_summary::records}
+	,{"errors"        , &volume_summary::errors}
+	,{"warnings"      , &volume_summary::warnings}
+	,{"debugs"        , &volume_summary::debugs}
+	,{"infos"         , &volume_summary::infos}
+	,{"data_bytes"    , &volume_summary::data_bytes}
+	,{"volume_bytes"  , &volume_summary::volume_bytes}
+	,{"index_bytes"   , &volume_summary::index_bytes}
+	,{"options"       , &volume_summary::options}
+	,{"callsites"     , &volume_summary::callsites}
+	,{"callsites_hash", &volume_summary::callsites_hash}
+};
+
+} // anon ns
+
+/**************************************************************************/
+
+std::uint64_t summary_callsites_hash(std::vector<std::string> callsites) {
+	std::sort(callsites.begin(), callsites.end());
+
+	std::uint64_t hash = 14695981039346656037ull;
+	for ( const auto &it: callsites ) {
+		for ( const char ch: it ) {
+			hash ^= static_cast<std::uint8_t>(ch);
+			hash *= 1099511628211ull;
+		}
+		hash ^= '\n';
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+/**************************************************************************/
+
+bool summary_write(const volume_summary &sum, const std::string &fname) {
+	const std::string tmpname = fname + ".tmp";
+	// readable by the owner only, like the volume it describes
+	std::FILE *file = detail::create_private(tmpname);
+	if ( !file )
+		return false;
+
+	bool ok = true;
+	for ( const auto &it: summary_fields ) {
+		ok = ok && std::fprintf(file, "%s=%" PRIu64 "\n", it.name, sum.*it.field) > 0;
+	}
+	ok = (std::fclose(file) == 0) && ok;
+
+	if ( !ok || std::rename(tmpname.c_str(), fname.c_str()) != 0 ) {
+		std::remove(tmpname.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+/**************************************************************************/
+
+bool summary_read(volume_summary *sum, const std::string &fname) {
+	std::FILE *file = std::fopen(fname.c_str(), "r");
+	if ( !file )
+		return false;
+
+	*sum = volume_summary();
+
+	std::size_t found = 0;
+	char line[128];
+	while ( std::fgets(line, sizeof(line), file) ) {
+		char *eq = std::strchr(line, '=');
+		if ( !eq )
+			continue;
+
+		*eq = 0;
+		for ( const auto &it: summary_fields ) {
+			if ( std::strcmp(line, it.name) == 0 ) {
+				sum->*it.field = std::strtoull(eq+1, nullptr, 10);
+				++found;
+				break;
+			}
+		}
+	}
+	std::fclose(file);
+
+	return found == sizeof(summary_fields)/sizeof(summary_fields[0]);
+}
+
+/**************************************************************************/
+
+bool summary_overlaps(const volume_summary &sum, std::uint64_t from_ts, std::uint64_t to_ts) {
+	return sum.records && sum.first_ts <= to_ts && sum.last_ts >= from_ts;
+}
+
+/**************************************************************************/
+
+} // ns yal
@@ -30,7 +30,9 @@
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <yal/yal.hpp>
+#include <yal/files.hpp>
 #include <yal/index.hpp>
+#include <yal/summary.hpp>
 #include <yal/throw.hpp>
 
 #include <cstdio>
@@ -38,8 +40,19 @@
 #include <cmath>
 
 #include <unordered_map>
+#include <unordered_set>
 #include <algorithm>
+#include <vector>
+#include <tuple>
 #include <mutex>
+#include <thread>
+#include <exception>
+#include <condition_variable>
+#include <future>
+#include <deque>
+#include <map>
+#include <chrono>
+#include <atomic>
 
 /***************************************************************************/
 
@@ -51,9 +64,12 @@ bool exists(const char *fname);
 
 #include <dirent.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 
 bool exists(const char *fname) {
     return ::access(fname, F_OK) == 0;
@@ -168,6 +184,11 @@ int fdatasync(int fd) {
     return 0;
 }
 
+int fsync(int fd) {
+    (void)fd;
+    return 0;
+}
+
 #ifndef S_IRUSR
 #   define S_IRUSR 0
 #endif // S_IRUSR
@@ -182,19 +203,9 @@ int fdatasync(int fd) {
 
 static const char active_ext[] = ".active";
 
-struct io_base {
-    virtual ~io_base() {}
-
-    virtual void create(const std::string &fname) = 0;
-    virtual void write(const void *ptr, const std::size_t size) = 0;
-    virtual void close() = 0;
-    virtual void fsync() = 0;
-    virtual std::size_t fpos() = 0;
-
-    static std::string normalize_fname(const std::string &fname) {
-        return fname.substr(0, fname.length()-std::strlen(active_ext));
-    }
-};
+std::string io_base::normalize_fname(const std::string &fname) {
+    return fname.substr(0, fname.length()-std::strlen(active_ext));
+}
 
 struct file_io: io_base {
     file_io()
@@ -231,6 +242,16 @@ struct file_io: io_base {
         ::fdatasync(fd);
     }
     std::size_t fpos() { return off; }
+    std::string name() const { return normalize_fname(fname); }
+    bool rename(const std::string &fn) {
+        const std::string newfname = fn+active_ext;
+        if ( fd == -1 || ::rename(fname.c_str(), newfname.c_str()) != 0 )
+            return false;
+
+        fname = newfname;
+
+        return true;
+    }
 
 private:
     int fd;
@@ -281,6 +302,16 @@ struct gz_file_io: io_base {
         __YAL_THROW_IF(gzfile == nullptr || fd == -1, "file \"" +fname+ "\" is not open");
         return static_cast<std::size_t>(::gztell(gzfile));
     }
+    std::string name() const { return normalize_fname(fname); }
+    bool rename(const std::string &fn) {
+        const std::string newfname = fn+".gz"+active_ext;
+        if ( fd == -1 || ::rename(fname.c_str(), newfname.c_str()) != 0 )
+            return false;
+
+        fname = newfname;
+
+        return true;
+    }
 
 private:
     int fd;
@@ -291,376 +322,3268 @@ private:
 struct gz_file_io: file_io {};
 #endif // YAL_SUPPORT_COMPRESSION
 
-/***************************************************************************/
-/***************************************************************************/
+io_base* io_base::create_default(std::uint32_t opts) {
+    return (opts & yal::compress)
+        ? static_cast<io_base*>(new gz_file_io)
+        : static_cast<io_base*>(new file_io)
+    ;
+}
+
 /***************************************************************************/
 
-struct session::impl {
-    static io_base* create_io(std::uint32_t opts) {
-        return (opts & yal::compress)
-            ? static_cast<io_base*>(new gz_file_io)
-            : static_cast<io_base*>(new file_io)
-        ;
+static std::pair<std::string, std::string> split_name(const std::string &path, const std::string &name) {
+    std::size_t pos = name.find_last_of('/');
+    if ( pos != std::string::npos ) {
+        return {path + "/" + name.substr(0, pos), name.substr(pos+1)};
     }
 
-    impl(
-         const std::string &path
-        ,const std::string &name
-        ,std::size_t volume_size
-        ,std::size_t opts
-        ,process_buffer proc
-    )
-        :m_path(path)
-        ,m_name(name)
-        ,m_volume_size(volume_size)
-        ,m_options(opts)
-        ,m_proc(std::move(proc))
-        ,m_shift_after(YAL_MAX_VOLUME_NUMBER)
-        ,m_logfile(create_io(opts))
-        ,m_idxfile(opts & create_index_file ? (create_io(opts)) : nullptr)
-        ,m_toterm(false)
-        ,m_prefix()
-        ,m_level(yal::info)
-        ,m_recbuf()
-        ,m_writen_bytes(0)
-        ,m_volume_number(0)
-    {
-        if ( m_name != "disable" ) {
-            m_volume_number = get_last_volume_number(m_path, m_name, ((m_options & yal::remove_empty_logs)>0));
-            create_volume();
-        } else {
-            m_level = yal::disable;
+    return {path, name};
+}
+
+static std::string manifest_fname(const std::string &path, const std::string &name) {
+    const auto pair = split_name(path, name);
+
+    return pair.first + "/" + pair.second + ".manifest";
+}
+
+struct manifest {
+    std::size_t volume;  // number of the last created volume
+    std::string logfile; // the final(without 'active_ext') name of the volume
+    std::string idxfile; // the final name of the index-file, or empty
+    bool active;         // false when the volume was closed properly
+    std::string nextlog; // the pre-created next volume, or empty
+    std::string nextidx; // the index-file of the pre-created next volume, or empty
+};
+
+std::FILE* create_private(const std::string &fname, bool append) {
+#ifdef _WIN32
+    return std::fopen(fname.c_str(), append ? "ab" : "w");
+#else
+    const int fd = ::open(fname.c_str(), O_WRONLY|O_CREAT|(append ? O_APPEND : O_TRUNC), S_IRUSR|S_IWUSR);
+    if ( fd == -1 )
+        return nullptr;
+
+    std::FILE *file = ::fdopen(fd, append ? "ab" : "w");
+    if ( !file )
+        ::close(fd);
+
+    return file;
+#endif // _WIN32
+}
+
+// makes the renames in the directory of 'fname' durable
+static void fsync_dir(const std::string &fname) {
+#ifndef _WIN32
+    const std::string::size_type pos = fname.rfind('/');
+    const std::string dir = pos == std::string::npos ? std::string(".") : fname.substr(0, pos);
+    const int fd = ::open(dir.c_str(), O_RDONLY);
+    if ( fd != -1 ) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+#else
+    (void)fname;
+#endif // _WIN32
+}
+
+static bool manifest_write(const manifest &man, const std::string &fname) {
+    const std::string tmpname = fname + ".tmp";
+    std::FILE *file = create_private(tmpname);
+    if ( !file )
+        return false;
+
+    const int n = std::fprintf(
+         file
+        ,"volume=%zu\nlogfile=%s\nidxfile=%s\nstate=%s\nnextlog=%s\nnextidx=%s\n"
+        ,man.volume
+        ,man.logfile.c_str()
+        ,man.idxfile.c_str()
+        ,(man.active ? "active" : "closed")
+        ,man.nextlog.c_str()
+        ,man.nextidx.c_str()
+    );
+    // the content must be on the disk before the rename, otherwise the manifest can be empty after a power loss
+    bool ok = std::fflush(file) == 0 && ::fsync(::fileno(file)) == 0 && n > 0;
+    ok = (std::fclose(file) == 0) && ok;
+    if ( !ok || std::rename(tmpname.c_str(), fname.c_str()) != 0 ) {
+        std::remove(tmpname.c_str());
+        return false;
+    }
+    fsync_dir(fname);
+
+    return true;
+}
+
+static bool manifest_read(manifest *man, const std::string &fname) {
+    std::FILE *file = std::fopen(fname.c_str(), "r");
+    if ( !file )
+        return false;
+
+    std::size_t found = 0;
+    char line[1024*4];
+    while ( std::fgets(line, sizeof(line), file) ) {
+        char *eq = std::strchr(line, '=');
+        if ( !eq )
+            continue;
+
+        *eq++ = 0;
+        eq[std::strcspn(eq, "\n")] = 0;
+        if ( std::strcmp(line, "volume") == 0 ) {
+            man->volume = std::strtoul(eq, nullptr, 10);
+            ++found;
+        } else if ( std::strcmp(line, "logfile") == 0 ) {
+            man->logfile = eq;
+            ++found;
+        } else if ( std::strcmp(line, "idxfile") == 0 ) {
+            man->idxfile = eq;
+            ++found;
+        } else if ( std::strcmp(line, "state") == 0 ) {
+            man->active = std::strcmp(eq, "active") == 0;
+            ++found;
+        } else if ( std::strcmp(line, "nextlog") == 0 ) {
+            man->nextlog = eq;
+        } else if ( std::strcmp(line, "nextidx") == 0 ) {
+            man->nextidx = eq;
         }
     }
-    ~impl() {
-        flush();
+    std::fclose(file);
+
+    return found == 4 && !man->logfile.empty();
+}
+
+// finishes the volume described by the manifest(renames an unfinished volume after crash,
+// removes an empty one) and returns the next volume number without scanning the directory.
+// returns false if the manifest is missing or doesn't match the files on disk.
+static bool recover_from_manifest(const std::string &fname, bool remove_empty, std::size_t *volnum) {
+    manifest man{};
+    if ( !manifest_read(&man, fname) )
+        return false;
+
+    std::vector<std::string> files{man.logfile};
+    if ( !man.idxfile.empty() )
+        files.push_back(man.idxfile);
+
+    for ( const auto &it: files ) {
+        const std::string active = it + active_ext;
+        if ( exists(active.c_str()) ) {
+            int ok = ::rename(active.c_str(), it.c_str());
+            __YAL_THROW_IF(ok, "can't rename unfinished volume");
+        } else if ( !exists(it.c_str()) ) {
+            return false;
+        }
     }
 
-    static std::string final_log_fname(const std::string &fname) {
-        return fname.substr(0, fname.length()-sizeof(active_ext)-1);
+    // the pre-created volume is removed if it was never written. otherwise the crash happened
+    // after it was swapped in but before the manifest was updated, so it's finished like
+    // the volume above and its number is taken.
+    const std::string nextactive = man.nextlog + active_ext;
+    // renamed when it was swapped in, so only the directory scan can find it
+    if ( !man.nextlog.empty() && !exists(nextactive.c_str()) && !exists(man.nextlog.c_str()) )
+        return false;
+
+    const bool next_used = !man.nextlog.empty() && (
+        (exists(nextactive.c_str()) && file_size(nextactive.c_str()) != 0) || exists(man.nextlog.c_str())
+    );
+    for ( const auto *it: {&man.nextlog, &man.nextidx} ) {
+        const std::string active = *it + active_ext;
+        if ( it->empty() || !exists(active.c_str()) )
+            continue;
+
+        if ( next_used ) {
+            int ok = ::rename(active.c_str(), it->c_str());
+            __YAL_THROW_IF(ok, "can't rename unfinished volume");
+        } else if ( file_size(active.c_str()) == 0 ) {
+            int ok = ::remove(active.c_str());
+            __YAL_THROW_IF(ok, "can't remove unused volume");
+        }
     }
-    static std::size_t get_last_volume_number(const std::string &path, const std::string &name, bool remove_empty) {
-        std::size_t volnum = 0;
-        std::string logpath, logfname;
 
-        std::size_t pos = name.find_last_of('/');
-        if ( pos != std::string::npos ) {
-            logpath = path + "/" + name.substr(0, pos);
-            logfname= name.substr(pos+1);
-        } else {
-            logpath = path;
-            logfname= name;
-        }
-
-        struct dirent* dirent;
-        DIR *dir = ::opendir(logpath.c_str());
-        if ( !dir ) return 0;
-        std::vector<std::string> empty_logs;
-        std::vector<std::string> for_rename;
-        while ( (dirent = readdir(dir)) != nullptr ) {
-            if ( (dirent->d_name[0] == '.' && dirent->d_name[1] == 0) ||
-                 (dirent->d_name[0] == '.' && dirent->d_name[1] == '.' && dirent->d_name[2] == 0)
-            ) {
-                continue;
-            }
+    if ( remove_empty && file_size(man.logfile.c_str()) == 0 ) {
+        for ( const auto &it: files ) {
+            int ok = ::remove(it.c_str());
+            __YAL_THROW_IF(ok, "can't remove empty volume");
+        }
+    }
 
-            std::string fname = dirent->d_name;
-            std::string fpath = logpath;
-            fpath += "/";
-            fpath += fname;
+    *volnum = man.volume + (next_used ? 2 : 1);
 
-            if ( is_directory(fpath.c_str()) )
-                continue;
+    return true;
+}
 
-            if ( fpath.find(logfname+"-") == std::string::npos )
-                continue;
+/***************************************************************************/
 
-            if ( remove_empty ) {
-                const auto filesize = file_size(fpath.c_str());
-                if ( filesize == 0 ) {
-                    empty_logs.push_back(fpath);
-                    continue;
-                }
-            }
+// the volumes found in a directory for one session name
+struct scanned_volumes {
+    std::size_t volnum;                 // the next volume number
+    std::size_t volnum_nonempty;        // the next volume number if the empty volumes are removed
+    std::vector<std::string> empty_logs;
+    std::vector<std::string> for_rename;
+};
+
+// session name(without path) -> volumes
+using scanned_dir = std::unordered_map<std::string, scanned_volumes>;
+
+// splits the volume file name '<name>-<number>-<yyyy.mm.dd-hh.mm.ss>[...]' into the session
+// name and the volume number. the name itself may contain '-'. returns false for other files.
+static bool parse_volume_fname(const std::string &fname, std::string *name, std::size_t *volnum) {
+    static const char datefmt[] = "dddd.dd.dd-dd.dd.dd";
+    for ( std::size_t pos = fname.find('-'); pos != std::string::npos; pos = fname.find('-', pos+1) ) {
+        std::size_t end = pos+1;
+        while ( end < fname.size() && std::isdigit(static_cast<unsigned char>(fname[end])) )
+            ++end;
+        if ( end == pos+1 || end == fname.size() || fname[end] != '-' )
+            continue;
+        if ( fname.size() - (end+1) < sizeof(datefmt)-1 )
+            continue;
 
-            if ( fname.find(active_ext) != std::string::npos )
-                for_rename.push_back(fpath);
+        bool date = true;
+        for ( std::size_t idx = 0; date && idx < sizeof(datefmt)-1; ++idx ) {
+            const char c = fname[end+1+idx];
+            date = datefmt[idx] == 'd' ? std::isdigit(static_cast<unsigned char>(c)) != 0 : c == datefmt[idx];
+        }
+        if ( !date )
+            continue;
 
-            auto beg = std::find(fname.begin(), fname.end(), '-');
-            if ( beg == fname.end() || beg+1 == fname.end() )
-                continue;
+        name->assign(fname, 0, pos);
+        *volnum = std::stoul(fname.substr(pos+1, end-pos-1));
 
-            ++beg;
+        return true;
+    }
 
-            if ( !std::isdigit(*beg) )
-                continue;
+    return false;
+}
+
+// reads the directory only once for all the sessions living in it.
+// the sizes are checked only if 'check_empty' is true.
+static scanned_dir scan_directory(const std::string &logpath, bool check_empty) {
+    scanned_dir res;
+
+    struct dirent* dirent;
+    DIR *dir = ::opendir(logpath.c_str());
+    if ( !dir ) return res;
+    while ( (dirent = readdir(dir)) != nullptr ) {
+        if ( (dirent->d_name[0] == '.' && dirent->d_name[1] == 0) ||
+             (dirent->d_name[0] == '.' && dirent->d_name[1] == '.' && dirent->d_name[2] == 0)
+        ) {
+            continue;
+        }
+
+        const std::string fname = dirent->d_name;
+        std::string name;
+        std::size_t num = 0;
+        if ( !parse_volume_fname(fname, &name, &num) )
+            continue;
 
-            auto end = beg;
-            for ( ; std::isdigit(*end); ++end)
-                ;
+        std::string fpath = logpath;
+        fpath += "/";
+        fpath += fname;
 
-            const auto num = std::stoul(std::string(beg, end)) + 1;
-            if ( num > volnum )
-                volnum = num;
+        if ( is_directory(fpath.c_str()) )
+            continue;
+
+        auto &vols = res[name];
+
+        bool empty = false;
+        if ( check_empty ) {
+            const auto filesize = file_size(fpath.c_str());
+            if ( filesize == 0 ) {
+                vols.empty_logs.push_back(fpath);
+                empty = true;
+            }
         }
 
-        for ( const auto &it: empty_logs ) {
+        // also the empty ones, they are left for the sessions which don't remove them
+        if ( fname.find(active_ext) != std::string::npos )
+            vols.for_rename.push_back(fpath);
+
+        num += 1;
+        if ( num > vols.volnum )
+            vols.volnum = num;
+        if ( !empty && num > vols.volnum_nonempty )
+            vols.volnum_nonempty = num;
+    }
+    ::closedir(dir);
+
+    return res;
+}
+
+// removes the empty volumes, renames the unfinished ones, and returns the next volume number
+static std::size_t finish_volumes(const scanned_volumes &vols, bool remove_empty) {
+    if ( remove_empty ) {
+        for ( const auto &it: vols.empty_logs ) {
             int ok = ::remove(it.c_str());
             __YAL_THROW_IF(ok, "can't remove empty volume");
         }
+    }
 
-        for ( const auto &it: for_rename ) {
-            const char *oldfname = it.c_str();
-            const std::string newfname = final_log_fname(it);
-            int ok = ::rename(oldfname, newfname.c_str());
-            __YAL_THROW_IF(ok, "can't rename unfinished volume");
+    for ( const auto &it: vols.for_rename ) {
+        if ( remove_empty && std::find(vols.empty_logs.begin(), vols.empty_logs.end(), it) != vols.empty_logs.end() )
+            continue;
+
+        const char *oldfname = it.c_str();
+        const std::string newfname = io_base::normalize_fname(it);
+        int ok = ::rename(oldfname, newfname.c_str());
+        __YAL_THROW_IF(ok, "can't rename unfinished volume");
+    }
+
+    return remove_empty ? vols.volnum_nonempty : vols.volnum;
+}
+
+static std::size_t get_last_volume_number(const std::string &path, const std::string &name, bool remove_empty) {
+    std::string logpath, logfname;
+    std::tie(logpath, logfname) = split_name(path, name);
+
+    const scanned_dir dir = scan_directory(logpath, remove_empty);
+    const auto it = dir.find(logfname);
+
+    return it != dir.end() ? finish_volumes(it->second, remove_empty) : 0;
+}
+
+/***************************************************************************/
+
+// executes the posted tasks one by one in the background thread.
+// the exception thrown by a task is rethrown by the next post().
+struct bg_worker {
+    bg_worker()
+        :m_mutex()
+        ,m_cv()
+        ,m_tasks()
+        ,m_error()
+        ,m_stop(false)
+        ,m_thread(&bg_worker::run, this)
+    {}
+    ~bg_worker() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
         }
+        m_cv.notify_one();
+        m_thread.join();
+    }
+
+    void post(std::function<void()> task) {
+        std::exception_ptr error;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::swap(error, m_error);
+            m_tasks.push_back(std::move(task));
+        }
+        m_cv.notify_one();
 
-        return volnum;
+        if ( error )
+            std::rethrow_exception(error);
     }
 
-    void create_volume() {
-        char fmt[64];
-        char pathbuf[1024*4];
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while ( true ) {
+            m_cv.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+            if ( m_tasks.empty() )
+                break;
 
-        if ( m_volume_number > m_shift_after ) {
-            m_shift_after = m_shift_after * 10 + 9;
+            auto task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+
+            lock.unlock();
+            try {
+                task();
+            } catch (...) {
+                lock.lock();
+                m_error = std::current_exception();
+                continue;
+            }
+            lock.lock();
         }
+    }
 
-        const int digits = static_cast<int>(std::log10(m_shift_after)+1);
-        std::snprintf(fmt, sizeof(fmt), "%s%d%s", "%s/%s-%0", digits, "d-%s");
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<std::function<void()>> m_tasks;
+    std::exception_ptr m_error;
+    bool m_stop;
+    std::thread m_thread;
+};
 
-        char datebuf[dtf::bufsize];
-        const auto flags = dtf::flags::yyyy_mm_dd|dtf::flags::secs|dtf::flags::sep2;
-        const auto n = dtf::timestamp_to_chars(datebuf, dtf::timestamp(), flags);
-        datebuf[n] = 0;
-        std::snprintf(
-             pathbuf
-            ,sizeof(pathbuf)
-            ,fmt
-            ,m_path.c_str()
-            ,m_name.c_str()
-            ,m_volume_number
-            ,datebuf
+/***************************************************************************/
+
+// the closed volumes of one session, oldest first.
+// volumes are added by the session and removed by the housekeeper.
+struct volume_inventory {
+    struct volume {
+        std::vector<std::string> files; // the volume itself, its index and summary
+        std::size_t bytes;
+        std::uint64_t ts;               // when the volume was closed, in nanoseconds
+    };
+
+    volume_inventory(std::string logpath, std::string logfname)
+        :m_mutex()
+        ,m_logpath(std::move(logpath))
+        ,m_logfname(std::move(logfname))
+        ,m_loaded(false)
+        ,m_policy()
+        ,m_volumes()
+        ,m_names()
+        ,m_bytes(0)
+    {}
+
+    // the session's own policy. without it only the global policy applies.
+    void policy(const retention_policy &policy) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_policy = policy;
+    }
+    bool has_policy() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return !unlimited(m_policy);
+    }
+    static bool unlimited(const retention_policy &policy) {
+        return !policy.max_bytes && !policy.max_volumes && !policy.max_age;
+    }
+
+    void add(volume vol) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if ( !m_names.insert(vol.files.front()).second )
+            return;
+
+        m_bytes += vol.bytes;
+        m_volumes.push_back(std::move(vol));
+    }
+    static volume make_volume(std::vector<std::string> files, std::uint64_t ts) {
+        std::size_t bytes = 0;
+        for ( const auto &it: files ) {
+            bytes += file_size(it.c_str());
+        }
+
+        return {std::move(files), bytes, ts};
+    }
+
+    // adds the volumes closed before the session was created.
+    // done once, by the housekeeper, when the first policy applies to the session,
+    // so the sessions without retention never scan the directory for it.
+    void load() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if ( m_loaded )
+                return;
+            m_loaded = true;
+        }
+
+        std::map<std::size_t, std::vector<std::string>> found;
+        DIR *dir = ::opendir(m_logpath.c_str());
+        if ( !dir ) return;
+        while ( struct dirent *dirent = ::readdir(dir) ) {
+            const std::string fname = dirent->d_name;
+            if ( fname.find(active_ext) != std::string::npos || fname.find(".tmp") != std::string::npos )
+                continue;
+
+            std::string name;
+            std::size_t num = 0;
+            if ( !parse_volume_fname(fname, &name, &num) || name != m_logfname )
+                continue;
+
+            found[num].push_back(m_logpath + "/" + fname);
+        }
+        ::closedir(dir);
+
+        for ( auto &it: found ) {
+            auto &files = it.second;
+            // the volume itself has the shortest name
+            std::sort(files.begin(), files.end(),
+                [](const std::string &l, const std::string &r) { return l.length() < r.length(); }
+            );
+
+            struct ::stat st{};
+            ::stat(files.front().c_str(), &st);
+            const std::uint64_t ts = static_cast<std::uint64_t>(st.st_mtime) * 1000000000ull;
+
+            add(make_volume(std::move(files), ts));
+        }
+
+        // the volumes closed by the session meanwhile are the youngest
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::stable_sort(m_volumes.begin(), m_volumes.end(),
+            [](const volume &l, const volume &r) { return l.ts < r.ts; }
         );
+    }
 
-        if ( const char *pos = std::strchr(m_name.c_str(), '.') ) {
-            std::strcat(pathbuf, pos);
+    // returns false if the inventory is empty
+    bool oldest(std::uint64_t *ts) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if ( m_volumes.empty() )
+            return false;
+
+        *ts = m_volumes.front().ts;
+
+        return true;
+    }
+    void totals(std::size_t *bytes, std::size_t *volumes) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        *bytes += m_bytes;
+        *volumes += m_volumes.size();
+    }
+
+    void remove_oldest() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        remove_oldest_impl();
+    }
+
+    // enforces the session's own policy
+    void enforce(std::uint64_t now) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const std::uint64_t max_age = m_policy.max_age * 1000000000ull;
+        while ( !m_volumes.empty() ) {
+            const bool too_many = m_policy.max_volumes && m_volumes.size() > m_policy.max_volumes;
+            const bool too_big  = m_policy.max_bytes && m_bytes > m_policy.max_bytes;
+            const bool too_old  = max_age && m_volumes.front().ts + max_age < now;
+            if ( !too_many && !too_big && !too_old )
+                break;
+
+            remove_oldest_impl();
         }
+    }
 
-        m_logfile->create(pathbuf);
+private:
+    void remove_oldest_impl() {
+        const auto &vol = m_volumes.front();
+        for ( const auto &it: vol.files ) {
+            ::remove(it.c_str());
+        }
+        m_names.erase(vol.files.front());
+        m_bytes -= vol.bytes;
+        m_volumes.pop_front();
+    }
 
-        if ( m_options & create_index_file ) {
-            std::strcat(pathbuf, ".idx");
-            m_idxfile->create(pathbuf);
+    std::mutex m_mutex;
+    const std::string m_logpath;
+    const std::string m_logfname;
+    bool m_loaded;
+    retention_policy m_policy;
+    std::deque<volume> m_volumes;
+    std::unordered_set<std::string> m_names;
+    std::size_t m_bytes;
+};
+
+/***************************************************************************/
+
+// enforces the retention policies in the background thread.
+// it runs every YAL_HOUSEKEEPING_INTERVAL milliseconds, or when a volume is closed.
+struct housekeeper {
+    // never destroyed, because the sessions may be closed during the static destruction
+    static housekeeper& instance() {
+        static housekeeper *object = new housekeeper;
+
+        return *object;
+    }
+
+    housekeeper()
+        :m_mutex()
+        ,m_cv()
+        ,m_inventories()
+        ,m_policy()
+        ,m_wakeup(false)
+        ,m_stop(false)
+        ,m_thread()
+    {}
+    ~housekeeper() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
         }
+        m_cv.notify_one();
+        if ( m_thread.joinable() )
+            m_thread.join();
     }
 
-    void flush() {
-        m_logfile->fsync();
-        if ( m_options & create_index_file )
-            m_idxfile->fsync();
+    // the inventories of all the sessions are added, the thread is started by the first policy
+    void add(std::weak_ptr<volume_inventory> inventory) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_inventories.push_back(std::move(inventory));
+    }
+    void session_policy() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            start();
+            m_wakeup = true;
+        }
+        m_cv.notify_one();
+    }
+    void global_policy(const retention_policy &policy) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_policy = policy;
+            start();
+            m_wakeup = true;
+        }
+        m_cv.notify_one();
+    }
+    retention_policy global_policy() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_policy;
+    }
+    void wakeup() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_wakeup = true;
+        }
+        m_cv.notify_one();
     }
-    void to_term(bool ok, const std::string &pref) { m_toterm = ok; m_prefix = pref; }
 
-    void write(
-         const char *fileline
-        ,std::size_t fileline_len
-        ,const char *sfileline
-        ,std::size_t sfileline_len
-        ,const char *sfunc
-        ,std::size_t sfunc_len
-        ,const char *func
-        ,std::size_t func_len
-        ,const std::string &data
-        ,const level lvl)
-    {
-        const auto dtres = (m_options & sec_res) ? dtf::flags::secs
-            : (m_options & msec_res) ? dtf::flags::msecs
-                : (m_options & usec_res) ? dtf::flags::usecs
-                    : dtf::flags::nsecs
-        ;
-        const auto dtflags = dtf::flags::yyyy_mm_dd|dtf::flags::sep3|dtres;
-        char dtbuf[dtf::bufsize];
-        const auto dt = dtf::timestamp();
-        const auto dtlen = dtf::timestamp_to_chars(dtbuf, dt, dtflags);
+private:
+    void start() {
+        if ( !m_thread.joinable() )
+            m_thread = std::thread(&housekeeper::run, this);
+    }
+    void run() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while ( !m_stop ) {
+            m_cv.wait_for(
+                 lock
+                ,std::chrono::milliseconds(YAL_HOUSEKEEPING_INTERVAL)
+                ,[this]() { return m_stop || m_wakeup; }
+            );
+            m_wakeup = false;
+            if ( m_stop )
+                break;
+
+            std::vector<std::shared_ptr<volume_inventory>> inventories;
+            for ( auto it = m_inventories.begin(); it != m_inventories.end(); ) {
+                if ( auto inventory = it->lock() ) {
+                    inventories.push_back(std::move(inventory));
+                    ++it;
+                } else {
+                    it = m_inventories.erase(it);
+                }
+            }
+            const retention_policy policy = m_policy;
 
-        if ( !(m_options & full_source_name) ) {
-            fileline = sfileline;
-            fileline_len = sfileline_len;
+            lock.unlock();
+            enforce(inventories, policy, dtf::timestamp());
+            lock.lock();
+        }
+    }
+    static void enforce(
+         const std::vector<std::shared_ptr<volume_inventory>> &inventories
+        ,const retention_policy &policy
+        ,std::uint64_t now)
+    {
+        // the global policy applies to all the sessions, so all of them must be loaded
+        const bool global = !volume_inventory::unlimited(policy);
+        for ( const auto &it: inventories ) {
+            if ( global || it->has_policy() ) {
+                it->load();
+                it->enforce(now);
+            }
         }
 
-        std::size_t lfunc_len = sfunc_len;
-        const char *lfunc_name = sfunc;
-        if ( m_options & full_func_name ) {
-            lfunc_len = func_len;
-            lfunc_name = func;
+        // the global policy removes the oldest volumes among all the sessions
+        const std::uint64_t max_age = policy.max_age * 1000000000ull;
+        std::size_t bytes = 0, volumes = 0;
+        for ( const auto &it: inventories ) {
+            it->totals(&bytes, &volumes);
         }
+        while ( true ) {
+            volume_inventory *oldest = nullptr;
+            std::uint64_t oldest_ts = UINT64_MAX;
+            for ( const auto &it: inventories ) {
+                std::uint64_t ts;
+                if ( it->oldest(&ts) && ts < oldest_ts ) {
+                    oldest = it.get();
+                    oldest_ts = ts;
+                }
+            }
+            if ( !oldest )
+                break;
 
-        const std::size_t reclen =
-            1 // '['
-            +dtlen
-            +2 // ']['
-            +1 // log-level char
+            const bool too_many = policy.max_volumes && volumes > policy.max_volumes;
+            const bool too_big  = policy.max_bytes && bytes > policy.max_bytes;
+            const bool too_old  = max_age && oldest_ts + max_age < now;
+            if ( !too_many && !too_big && !too_old )
+                break;
+
+            oldest->remove_oldest();
+            bytes = volumes = 0;
+            for ( const auto &it: inventories ) {
+                it->totals(&bytes, &volumes);
+            }
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::vector<std::weak_ptr<volume_inventory>> m_inventories;
+    retention_policy m_policy;
+    bool m_wakeup;
+    bool m_stop;
+    std::thread m_thread;
+};
+
+/***************************************************************************/
+
+// the record as it's stored in the 'record_ring', followed by the record text
+struct record_header {
+    std::uint64_t ts;           // the timestamp, in nanoseconds
+    const char   *fileline;     // the string-literal, identifies the callsite
+    char         *external;     // the record text, if it's too big for the ring
+    std::uint32_t size;         // the space occupied in the ring, header included
+    std::uint32_t reclen;       // length of the record text
+    std::uint32_t func_len;
+    std::uint32_t data_len;
+    std::uint16_t dt_len;
+    std::uint16_t fileline_len;
+    std::uint8_t  lvl;
+};
+
+// the parts of a record, selected according to the session options
+struct record_parts {
+    std::uint64_t ts;
+    char          dtbuf[dtf::bufsize];
+    std::size_t   dt_len;
+    const char   *fileline;
+    std::size_t   fileline_len;
+    const char   *func;
+    std::size_t   func_len;
+    const char   *data;
+    std::size_t   data_len;
+    level         lvl;
+    const char   *assembled; // the whole record, if it was formatted already
+
+    // the options affecting the record text. the sessions with equal keys
+    // have equal records. the resolution is normalized, so there are 16 keys at most.
+    static std::size_t format_key(std::size_t opts) {
+        const std::size_t res = (opts & sec_res) ? sec_res
+            : (opts & msec_res) ? msec_res
+                : (opts & usec_res) ? usec_res
+                    : nsec_res
+        ;
+
+        return res | (opts & (full_source_name|full_func_name));
+    }
+
+    record_parts(
+         std::size_t opts
+        ,std::uint64_t ts
+        ,const char *fileline
+        ,std::size_t fileline_len
+        ,const char *sfileline
+        ,std::size_t sfileline_len
+        ,const char *sfunc
+        ,std::size_t sfunc_len
+        ,const char *func
+        ,std::size_t func_len
+        ,const std::string &data
+        ,level lvl)
+        :ts(ts)
+        ,dt_len(0)
+        ,fileline((opts & full_source_name) ? fileline : sfileline)
+        ,fileline_len((opts & full_source_name) ? fileline_len : sfileline_len)
+        ,func((opts & full_func_name) ? func : sfunc)
+        ,func_len((opts & full_func_name) ? func_len : sfunc_len)
+        ,data(data.c_str())
+        ,data_len(data.length())
+        ,lvl(lvl)
+        ,assembled(nullptr)
+    {
+        dt_len = dtf::timestamp_to_chars(dtbuf, ts, dt_flags(opts));
+    }
+
+    static std::size_t dt_flags(std::size_t opts) {
+        const auto dtres = (opts & sec_res) ? dtf::flags::secs
+            : (opts & msec_res) ? dtf::flags::msecs
+                : (opts & usec_res) ? dtf::flags::usecs
+                    : dtf::flags::nsecs
+        ;
+
+        return dtf::flags::yyyy_mm_dd|dtf::flags::sep3|dtres;
+    }
+
+    std::size_t length() const {
+        return
+            1 // '['
+            +dt_len
+            +2 // ']['
+            +1 // log-level char
             +2 // ']['
             +fileline_len
             +2 // ']['
-            +lfunc_len
+            +func_len
             +3 // ']: '
-            +data.length()
+            +data_len
             +1 // '\n'
         ;
+    }
+    void format(char *p) const {
+        if ( assembled ) {
+            std::memcpy(p, assembled, length());
+            return;
+        }
+
+        *p++ = '[';
+        std::memcpy(p, dtbuf, dt_len);
+        p += dt_len;
+        *p++ = ']';
+        *p++ = '[';
+        *p++ = level_chr(lvl);
+        *p++ = ']';
+        *p++ = '[';
+        std::memcpy(p, fileline, fileline_len);
+        p += fileline_len;
+        *p++ = ']';
+        *p++ = '[';
+        std::memcpy(p, func, func_len);
+        p += func_len;
+        *p++ = ']';
+        *p++ = ':';
+        *p++ = ' ';
+        std::memcpy(p, data, data_len);
+        p += data_len;
+        *p = '\n';
+    }
+    record_header header(std::size_t size) const {
+        return {
+             ts
+            ,fileline
+            ,nullptr
+            ,static_cast<std::uint32_t>(size)
+            ,static_cast<std::uint32_t>(length())
+            ,static_cast<std::uint32_t>(func_len)
+            ,static_cast<std::uint32_t>(data_len)
+            ,static_cast<std::uint16_t>(dt_len)
+            ,static_cast<std::uint16_t>(fileline_len)
+            ,static_cast<std::uint8_t>(lvl)
+        };
+    }
+};
+
+/***************************************************************************/
+
+// the multi-producer byte ring for the records.
+// a producer reserves the space with one fetch_add, fills it in parallel with the other
+// producers, and publishes it in the reservation order. there is one consumer at a time.
+struct record_ring {
+    enum: std::size_t { align = 8, cacheline = 64 };
+
+    explicit record_ring(std::size_t capacity)
+        :m_reserved(0)
+        ,m_published(0)
+        ,m_consumed(0)
+        ,m_mask(capacity-1)
+        ,m_buf(new char[capacity])
+    {
+        __YAL_THROW_IF(capacity < 1024 || (capacity & (capacity-1)) != 0, "ring capacity must be a power of two");
+    }
+
+    std::size_t capacity() const { return m_mask+1; }
+    // the records which are bigger are stored outside the ring
+    std::size_t max_record_size() const { return capacity() / 4; }
+    static std::size_t aligned(std::size_t size) { return (size + align-1) & ~(align-1); }
+
+    // returns the position of the reserved space.
+    // 'wait' is called while there is no free space.
+    template<typename F>
+    std::uint64_t reserve(std::size_t size, F wait) {
+        const std::uint64_t pos = m_reserved.fetch_add(size, std::memory_order_relaxed);
+        for ( std::size_t spins = 0; pos + size - m_consumed.load(std::memory_order_acquire) > capacity(); ++spins ) {
+            wait(spins);
+        }
+
+        return pos;
+    }
+    // makes the record visible to the consumer after all the previously reserved ones.
+    template<typename F>
+    void publish(std::uint64_t pos, std::size_t size, F wait) {
+        for ( std::size_t spins = 0; m_published.load(std::memory_order_acquire) != pos; ++spins ) {
+            wait(spins);
+        }
+        m_published.store(pos + size, std::memory_order_seq_cst);
+    }
+
+    // returns null if the range wraps around the end of the ring
+    char* contiguous(std::uint64_t pos, std::size_t size) {
+        const std::size_t off = pos & m_mask;
+        return off + size <= capacity() ? m_buf.get() + off : nullptr;
+    }
+    void copy_in(std::uint64_t pos, const void *src, std::size_t size) {
+        const std::size_t off = pos & m_mask;
+        const std::size_t first = std::min(size, capacity() - off);
+        std::memcpy(m_buf.get() + off, src, first);
+        std::memcpy(m_buf.get(), static_cast<const char*>(src) + first, size - first);
+    }
+    void copy_out(void *dst, std::uint64_t pos, std::size_t size) const {
+        const std::size_t off = pos & m_mask;
+        const std::size_t first = std::min(size, capacity() - off);
+        std::memcpy(dst, m_buf.get() + off, first);
+        std::memcpy(static_cast<char*>(dst) + first, m_buf.get(), size - first);
+    }
+
+    // reserves the space only if it's free
+    bool try_reserve(std::size_t size, std::uint64_t *pos) {
+        std::uint64_t cur = m_reserved.load(std::memory_order_relaxed);
+        do {
+            if ( cur + size - m_consumed.load(std::memory_order_acquire) > capacity() )
+                return false;
+        } while ( !m_reserved.compare_exchange_weak(cur, cur + size, std::memory_order_relaxed) );
+        *pos = cur;
+
+        return true;
+    }
+
+    std::uint64_t published() const { return m_published.load(std::memory_order_seq_cst); }
+    std::uint64_t consumed() const { return m_consumed.load(std::memory_order_relaxed); }
+    void consumed(std::uint64_t pos) { m_consumed.store(pos, std::memory_order_release); }
+    // the bytes reserved but not consumed yet
+    std::size_t depth() const {
+        return static_cast<std::size_t>(m_reserved.load(std::memory_order_relaxed) - m_consumed.load(std::memory_order_relaxed));
+    }
+
+private:
+    // each counter is on its own cache line
+    std::atomic<std::uint64_t> m_reserved;
+    char m_pad0[cacheline - sizeof(std::atomic<std::uint64_t>)];
+    std::atomic<std::uint64_t> m_published;
+    char m_pad1[cacheline - sizeof(std::atomic<std::uint64_t>)];
+    std::atomic<std::uint64_t> m_consumed;
+    char m_pad2[cacheline - sizeof(std::atomic<std::uint64_t>)];
+    const std::size_t m_mask;
+    std::unique_ptr<char[]> m_buf;
+};
+
+// is used while spinning on the ring
+inline void backoff(std::size_t spins) {
+    if ( spins > 64 )
+        std::this_thread::yield();
+}
+
+/***************************************************************************/
+
+// a record held by the reordering window(see 'reorder_records')
+struct held_record {
+    record_header hdr;
+    std::uint64_t seq; // keeps the order of the records with equal timestamps
+    std::string   rec;
+
+    // for the min-heap
+    bool operator< (const held_record &r) const {
+        return hdr.ts != r.hdr.ts ? hdr.ts > r.hdr.ts : seq > r.seq;
+    }
+};
+
+/***************************************************************************/
+
+// the staging ring of one producer thread for one session(see 'per_thread_buffers').
+// the producer thread is the only writer, and the sink of the session is the only reader,
+// so the producers never share a cache line.
+struct thread_staging {
+    explicit thread_staging(std::size_t capacity)
+        :ring(capacity)
+        ,orphaned(false)
+        ,closed(false)
+    {}
+
+    record_ring ring;
+    std::atomic<bool> orphaned; // the producer thread has exited
+    std::atomic<bool> closed;   // the session was destroyed
+};
+
+// all the stagings of the current thread, one per session
+struct thread_stagings {
+    thread_stagings()
+        :map()
+        ,last_id(0)
+        ,last(nullptr)
+    {}
+    ~thread_stagings() {
+        // the remaining records will be written by the session
+        for ( const auto &it: map ) {
+            it.second->orphaned.store(true, std::memory_order_release);
+        }
+    }
+
+    static thread_stagings& instance() {
+        static thread_local thread_stagings object;
+
+        return object;
+    }
+
+    // returns null if the thread has no staging for the session yet.
+    // the ids are never reused, so the cached one is valid while the session lives.
+    thread_staging* find(std::uint64_t session_id) {
+        if ( session_id == last_id )
+            return last;
+
+        const auto it = map.find(session_id);
+        if ( it == map.end() )
+            return nullptr;
+
+        last_id = session_id;
+        last = it->second.get();
+
+        return last;
+    }
+    void add(std::uint64_t session_id, std::shared_ptr<thread_staging> staging) {
+        // the stagings of the destroyed sessions are released only here, so the lookup stays O(1)
+        for ( auto it = map.begin(); it != map.end(); ) {
+            if ( it->second->closed.load(std::memory_order_relaxed) ) {
+                if ( it->first == last_id ) {
+                    last_id = 0;
+                    last = nullptr;
+                }
+                it = map.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        map.emplace(session_id, std::move(staging));
+    }
+
+    std::unordered_map<std::uint64_t, std::shared_ptr<thread_staging>> map;
+    std::uint64_t last_id; // zero is never used by a session
+    thread_staging *last;
+};
+
+/***************************************************************************/
+
+// the counters of the session writes updated by the writer threads.
+// each thread uses one of YAL_STATS_SHARDS shards, so the threads rarely share a cache line.
+struct stats_shard {
+    stats_shard() {
+        for ( auto &it: records ) it.store(0, std::memory_order_relaxed);
+        for ( auto &it: bytes ) it.store(0, std::memory_order_relaxed);
+        for ( auto &it: latency ) it.store(0, std::memory_order_relaxed);
+        latency_sum.store(0, std::memory_order_relaxed);
+        latency_max.store(0, std::memory_order_relaxed);
+    }
+
+    void account(level lvl, std::size_t len, std::uint64_t nsecs) {
+        records[lvl].fetch_add(1, std::memory_order_relaxed);
+        bytes[lvl].fetch_add(len, std::memory_order_relaxed);
+        latency[latency_histogram::bucket(nsecs)].fetch_add(1, std::memory_order_relaxed);
+        latency_sum.fetch_add(nsecs, std::memory_order_relaxed);
+        std::uint64_t max = latency_max.load(std::memory_order_relaxed);
+        while ( nsecs > max && !latency_max.compare_exchange_weak(max, nsecs, std::memory_order_relaxed) )
+            ;
+    }
+    // adds the shard to 'stats'
+    void collect(session_stats *stats) const {
+        for ( std::size_t idx = 0; idx <= info; ++idx ) {
+            stats->records[idx] += records[idx].load(std::memory_order_relaxed);
+            stats->bytes[idx] += bytes[idx].load(std::memory_order_relaxed);
+        }
+        latency_histogram &hist = stats->latency;
+        for ( std::size_t idx = 0; idx < latency_histogram::buckets; ++idx ) {
+            const std::uint64_t cnt = latency[idx].load(std::memory_order_relaxed);
+            hist.counts[idx] += cnt;
+            hist.total += cnt;
+        }
+        hist.sum += latency_sum.load(std::memory_order_relaxed);
+        hist.max = std::max(hist.max, latency_max.load(std::memory_order_relaxed));
+    }
+
+    // the thread keeps its shard for all the sessions
+    static std::size_t thread_index() {
+        static std::atomic<std::size_t> next(0);
+        static thread_local const std::size_t idx = next.fetch_add(1, std::memory_order_relaxed) % YAL_STATS_SHARDS;
+
+        return idx;
+    }
+
+    std::atomic<std::uint64_t> records[info+1];
+    std::atomic<std::uint64_t> bytes[info+1];
+    std::atomic<std::uint64_t> latency[latency_histogram::buckets];
+    std::atomic<std::uint64_t> latency_sum;
+    std::atomic<std::uint64_t> latency_max;
+    char pad[record_ring::cacheline]; // from the next shard
+};
+
+/***************************************************************************/
+
+// '*' matches any sequence, '?' matches any char
+static bool glob_match(const char *pattern, const char *str) {
+    const char *star = nullptr, *backtrack = nullptr;
+    while ( *str ) {
+        if ( *pattern == '*' ) {
+            star = ++pattern;
+            backtrack = str;
+        } else if ( *pattern == '?' || *pattern == *str ) {
+            ++pattern;
+            ++str;
+        } else if ( star ) {
+            pattern = star;
+            str = ++backtrack;
+        } else {
+            return false;
+        }
+    }
+    while ( *pattern == '*' )
+        ++pattern;
+
+    return *pattern == 0;
+}
+
+bool callsite_filter::match(const callsite &cs) const {
+    if ( line && line != cs.line )
+        return false;
+    if ( !func.empty() && func != cs.func )
+        return false;
+    if ( file.empty() )
+        return true;
+
+    const char *sep = std::strrchr(cs.file, __YAL_CHARSEP);
+    return glob_match(file.c_str(), cs.file) || (sep && glob_match(file.c_str(), sep+1));
+}
+
+// all the executed callsites, and the rules for the not executed yet ones
+struct callsite_registry {
+    // never destroyed, because the callsites may be executed during the static destruction
+    static callsite_registry& instance() {
+        static callsite_registry *object = new callsite_registry;
+
+        return *object;
+    }
+
+    std::mutex mutex;
+    std::vector<callsite*> callsites;
+    std::vector<std::pair<callsite_filter, callsite::mode>> rules;
+};
+
+bool callsite::enroll(level session_level) {
+    auto &registry = callsite_registry::instance();
+    {
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        if ( m_mode.load(std::memory_order_relaxed) == unregistered ) {
+            mode m = by_level;
+            for ( const auto &it: registry.rules ) {
+                if ( it.first.match(*this) )
+                    m = it.second;
+            }
+            registry.callsites.push_back(this);
+            m_mode.store(m, std::memory_order_relaxed);
+        }
+    }
+
+    return enabled_for(session_level);
+}
+
+/***************************************************************************/
+/***************************************************************************/
+/***************************************************************************/
+
+struct session_registry;
+
+struct session::impl {
+    impl(
+         const std::string &path
+        ,const std::string &name
+        ,std::size_t volume_size
+        ,std::size_t opts
+        ,process_buffer proc
+        ,std::size_t volume_number
+        ,io_factory io
+    )
+        :m_path(path)
+        ,m_name(name)
+        ,m_volume_size(volume_size)
+        ,m_options(opts)
+        ,m_proc(std::move(proc))
+        ,m_io(std::move(io))
+        ,m_logfile()
+        ,m_idxfile()
+        ,m_toterm(false)
+        ,m_prefix()
+        ,m_registry(nullptr)
+        ,m_recbuf()
+        ,m_writen_bytes(0)
+        ,m_volume_number(0)
+        ,m_summary()
+        ,m_last_callsite(nullptr)
+        ,m_callsites()
+        ,m_manifest_fname(manifest_fname(path, name))
+        ,m_volume_opened(false)
+        ,m_next_volume()
+        ,m_worker()
+        ,m_rotation_interval(
+            (opts & rotate_daily) ? 24ull*60*60*1000000000ull
+                : (opts & rotate_hourly) ? 60ull*60*1000000000ull
+                    : 0
+        )
+        ,m_next_rotation_ts(UINT64_MAX)
+        ,m_inventory()
+        ,m_ring(YAL_SESSION_BUFFER_SIZE)
+        ,m_sink_busy(false)
+        ,m_id(next_id())
+        ,m_stagings_mutex()
+        ,m_stagings()
+        ,m_stagings_version(0)
+        ,m_stagings_copy()
+        ,m_stagings_seen(0)
+        ,m_backend_mutex()
+        ,m_backend_cv()
+        ,m_backend_idle(false)
+        ,m_backend_wakeup(false)
+        ,m_backend_stop(false)
+        ,m_backend_error()
+        ,m_error_deferred(false)
+        ,m_backend()
+        ,m_held()
+        ,m_held_pool()
+        ,m_held_seq(0)
+        ,m_released_ts(0)
+        ,m_reorder_window(YAL_REORDER_WINDOW * 1000ull)
+        ,m_late_records(0)
+        ,m_fold()
+        ,m_overflow(overflow_block)
+        ,m_overflow_timeout(0)
+        ,m_dropped_records(0)
+        ,m_blocked_records(0)
+        ,m_spilled_records(0)
+        ,m_spill_mutex()
+        ,m_spill_file()
+        ,m_budget_rate(0)
+        ,m_budget_burst(0)
+        ,m_budget_policy(budget_drop)
+        ,m_budget_tokens(0)
+        ,m_budget_ts(0)
+        ,m_over_budget_records(0)
+        ,m_downgraded_records(0)
+        ,m_shed_state(0)
+        ,m_shed_mutex()
+        ,m_shed_reported()
+        ,m_shed_p99(0)
+        ,m_shed_rate(0)
+        ,m_shed_pressure(0)
+        ,m_shed_sample_ts(0)
+        ,m_shed_prev()
+        ,m_stats(new stats_shard[YAL_STATS_SHARDS])
+        ,m_rotations(0)
+        ,m_fsyncs(0)
+        ,m_errors(0)
+    {
+        for ( auto &it: m_shed ) {
+            it.store(0, std::memory_order_relaxed);
+        }
+
+        if ( m_name != "disable" ) {
+            // every session is known to the housekeeper, for the global policy
+            const auto pair = split_name(m_path, m_name);
+            m_inventory = std::make_shared<volume_inventory>(pair.first, pair.second);
+            housekeeper::instance().add(m_inventory);
+
+            m_volume_number = volume_number;
+            if ( !(m_options & lazy_volume_create) ) {
+                open_volume();
+            }
+        }
+
+        // the last, because nothing may throw after it
+        if ( m_options & (per_thread_buffers|reorder_records) ) {
+            m_backend = std::thread(&impl::backend_run, this);
+        }
+    }
+    ~impl() {
+        stop_backend();
+        flush();
+        if ( m_volume_opened ) {
+            close_volume(true);
+        }
+        discard_next_volume();
+        m_worker.reset();
+    }
+
+    // finds the volume number if it's not known yet, and creates the volume
+    void open_volume() {
+        if ( m_volume_number == unknown_volume_number ) {
+            const bool remove_empty = (m_options & yal::remove_empty_logs) > 0;
+            if ( !(m_options & use_manifest_file) || !recover_from_manifest(m_manifest_fname, remove_empty, &m_volume_number) ) {
+                m_volume_number = get_last_volume_number(m_path, m_name, remove_empty);
+            }
+        }
+
+        create_volume();
+    }
+
+    struct volume_files {
+        std::unique_ptr<io_base> logfile;
+        std::unique_ptr<io_base> idxfile;
+    };
+
+    std::string volume_fname(std::size_t volnum) const {
+        char fmt[64];
+        char pathbuf[1024*4];
+
+        std::size_t shift_after = YAL_MAX_VOLUME_NUMBER;
+        while ( volnum > shift_after ) {
+            shift_after = shift_after * 10 + 9;
+        }
+
+        const int digits = static_cast<int>(std::log10(shift_after)+1);
+        std::snprintf(fmt, sizeof(fmt), "%s%d%s", "%s/%s-%0", digits, "zu-%s");
+
+        char datebuf[dtf::bufsize];
+        const auto flags = dtf::flags::yyyy_mm_dd|dtf::flags::secs|dtf::flags::sep2;
+        const auto n = dtf::timestamp_to_chars(datebuf, dtf::timestamp(), flags);
+        datebuf[n] = 0;
+        std::snprintf(
+             pathbuf
+            ,sizeof(pathbuf)
+            ,fmt
+            ,m_path.c_str()
+            ,m_name.c_str()
+            ,volnum
+            ,datebuf
+        );
+
+        if ( const char *pos = std::strchr(m_name.c_str(), '.') ) {
+            std::strcat(pathbuf, pos);
+        }
+
+        return pathbuf;
+    }
+    io_base* create_io() const {
+        return m_io ? m_io(static_cast<std::uint32_t>(m_options)) : io_base::create_default(static_cast<std::uint32_t>(m_options));
+    }
+    volume_files make_volume_files(std::size_t volnum) const {
+        const std::string fname = volume_fname(volnum);
+
+        volume_files files;
+        files.logfile.reset(create_io());
+        files.logfile->create(fname);
+
+        if ( m_options & create_index_file ) {
+            files.idxfile.reset(create_io());
+            files.idxfile->create(fname+".idx");
+        }
+
+        return files;
+    }
+
+    void update_manifest(const manifest &man) const {
+        bool ok = manifest_write(man, m_manifest_fname);
+        __YAL_THROW_IF(!ok, "can't write manifest \"" +m_manifest_fname+ "\"");
+    }
+
+    void create_volume() {
+        volume_files files;
+        if ( (m_options & precreate_next_volume) && m_next_volume.valid() ) {
+            files = m_next_volume.get();
+            // the pre-created volume is named by the time it was created, but its name
+            // must tell when it was started, like for the volumes created in place
+            const std::string fname = volume_fname(m_volume_number);
+            if ( files.logfile->rename(fname) && files.idxfile ) {
+                files.idxfile->rename(fname+".idx");
+            }
+        } else {
+            files = make_volume_files(m_volume_number);
+        }
+        m_logfile = std::move(files.logfile);
+        m_idxfile = std::move(files.idxfile);
+
+        update_rotation_time(dtf::timestamp());
+
+        m_summary = volume_summary();
+        m_summary.options = m_options;
+        m_last_callsite = nullptr;
+        m_callsites.clear();
+
+        m_volume_opened = true;
+
+        if ( m_options & precreate_next_volume ) {
+            precreate_volume();
+        } else if ( m_options & use_manifest_file ) {
+            update_manifest({m_volume_number, m_logfile->name(), m_idxfile ? m_idxfile->name() : std::string(), true, {}, {}});
+        }
+    }
+    // the next volume is created in the background, so the rotation only swaps the files
+    void precreate_volume() {
+        if ( !m_worker )
+            m_worker.reset(new bg_worker);
+
+        const std::size_t volnum = m_volume_number;
+        const std::string logfname = m_logfile->name();
+        const std::string idxfname = m_idxfile ? m_idxfile->name() : std::string();
+        auto promise = std::make_shared<std::promise<volume_files>>();
+        m_next_volume = promise->get_future();
+
+        m_worker->post(
+            [this, volnum, logfname, idxfname, promise]() {
+                try {
+                    volume_files next = make_volume_files(volnum+1);
+                    if ( m_options & use_manifest_file ) {
+                        update_manifest({volnum, logfname, idxfname, true, next.logfile->name()
+                            ,next.idxfile ? next.idxfile->name() : std::string()});
+                    }
+                    promise->set_value(std::move(next));
+                } catch (...) {
+                    promise->set_exception(std::current_exception());
+                }
+            }
+        );
+    }
+    // removes the pre-created volume which will never be used
+    void discard_next_volume() {
+        if ( !m_next_volume.valid() )
+            return;
+
+        volume_files next = m_next_volume.get();
+        for ( io_base *io: {next.logfile.get(), next.idxfile.get()} ) {
+            if ( io ) {
+                const std::string fname = io->name();
+                io->close();
+                ::remove(fname.c_str());
+            }
+        }
+    }
+    // 'last' is true when the session is closing and no more volumes will be created
+    void close_volume(bool last = false) {
+        auto files = std::make_shared<volume_files>();
+        files->logfile = std::move(m_logfile);
+        files->idxfile = std::move(m_idxfile);
+
+        m_volume_opened = false;
+
+        std::shared_ptr<volume_summary> summary;
+        if ( m_options & create_summary_file ) {
+            summary = std::make_shared<volume_summary>(m_summary);
+            std::vector<std::string> callsites(m_callsites.begin(), m_callsites.end());
+            summary->callsites = callsites.size();
+            summary->callsites_hash = summary_callsites_hash(std::move(callsites));
+        }
+
+        const std::size_t volnum = m_volume_number;
+        auto inventory = m_inventory;
+        auto finish = [this, files, summary, volnum, last, inventory]() {
+            const std::string volume_fname = files->logfile->name();
+            // with pre-created volumes the manifest is updated when the next volume is ready
+            if ( (m_options & use_manifest_file) && (last || !(m_options & precreate_next_volume)) ) {
+                update_manifest({volnum, volume_fname, files->idxfile ? files->idxfile->name() : std::string(), false, {}, {}});
+            }
+
+            files->logfile->close();
+            if ( files->idxfile )
+                files->idxfile->close();
+
+            if ( summary ) {
+                bool ok = summary_write(*summary, volume_fname+".sum");
+                __YAL_THROW_IF(!ok, "can't write summary for volume \"" +volume_fname+ "\"");
+            }
+
+            if ( inventory ) {
+                std::vector<std::string> fnames{volume_fname};
+                if ( files->idxfile )
+                    fnames.push_back(files->idxfile->name());
+                if ( summary )
+                    fnames.push_back(volume_fname+".sum");
+
+                inventory->add(volume_inventory::make_volume(std::move(fnames), dtf::timestamp()));
+                housekeeper::instance().wakeup();
+            }
+        };
+
+        // the old volume is closed and renamed in the background
+        if ( m_worker ) {
+            m_worker->post(std::move(finish));
+        } else {
+            finish();
+        }
+    }
+    void update_summary(const char *fileline, std::uint64_t dt, level lvl, std::size_t reclen, std::size_t wrlen) {
+        if ( !m_summary.records )
+            m_summary.first_ts = dt;
+        m_summary.last_ts = dt;
+        m_summary.records += 1;
+        switch ( lvl ) {
+            case yal::error  : m_summary.errors   += 1; break;
+            case yal::warning: m_summary.warnings += 1; break;
+            case yal::debug  : m_summary.debugs   += 1; break;
+            case yal::info   : m_summary.infos    += 1; break;
+            default: break;
+        }
+        m_summary.data_bytes += reclen;
+        m_summary.volume_bytes += wrlen;
+        if ( m_options & create_index_file )
+            m_summary.index_bytes += sizeof(index_record);
+
+        // the fileline is a string-literal, so the pointer identifies the callsite
+        if ( fileline != m_last_callsite ) {
+            m_last_callsite = fileline;
+            m_callsites.insert(fileline);
+        }
+    }
+
+    // takes the consumer side of the ring. the holder of the lock is the only thread
+    // which writes the volume, so the volume state needs no other synchronization.
+    bool try_lock_sink() { return !m_sink_busy.exchange(true, std::memory_order_seq_cst); }
+    void unlock_sink() { m_sink_busy.store(false, std::memory_order_seq_cst); }
+    void lock_sink() {
+        for ( std::size_t spins = 0; !try_lock_sink(); ++spins ) {
+            backoff(spins);
+        }
+    }
+    struct sink_guard {
+        explicit sink_guard(impl *self): self(self) { self->lock_sink(); }
+        ~sink_guard() { self->unlock_sink(); }
+        impl *self;
+    };
+
+    // keeps the error which can't be thrown where it happens: in the backend thread, or while
+    // a writer waits for the space between the reservation and the publication.
+    // it's thrown by the next drain() or flush(), the first one if there are several.
+    void defer_error(std::exception_ptr error) {
+        std::lock_guard<std::mutex> lock(m_backend_mutex);
+        if ( !m_backend_error )
+            m_backend_error = std::move(error);
+        m_error_deferred.store(true, std::memory_order_release);
+    }
+    void rethrow_deferred() {
+        if ( !m_error_deferred.load(std::memory_order_acquire) )
+            return;
+
+        std::exception_ptr error;
+        {
+            std::lock_guard<std::mutex> lock(m_backend_mutex);
+            std::swap(error, m_backend_error);
+            m_error_deferred.store(false, std::memory_order_relaxed);
+        }
+        if ( error )
+            std::rethrow_exception(error);
+    }
+
+    // writes the published records. if another thread is writing them already
+    // it will also write the records published by this thread, so just return.
+    void drain() {
+        while ( try_lock_sink() ) {
+            try {
+                consume_published(m_ring);
+                if ( m_options & reorder_records )
+                    release_held(false);
+            } catch (...) {
+                unlock_sink();
+                throw;
+            }
+            unlock_sink();
+
+            // was something published after the last check but before the unlock?
+            if ( m_ring.published() == m_ring.consumed() )
+                break;
+        }
+
+        rethrow_deferred();
+    }
+    // returns the number of records written. must be called with the sink locked
+    std::size_t consume_published(record_ring &ring) {
+        const std::uint64_t published = ring.published();
+        std::uint64_t pos = ring.consumed();
+        std::size_t records = 0;
+        while ( pos != published ) {
+            record_header hdr;
+            ring.copy_out(&hdr, pos, sizeof(hdr));
+
+            const char *rec = hdr.external;
+            if ( !rec ) {
+                rec = ring.contiguous(pos+sizeof(hdr), hdr.reclen);
+                if ( !rec ) {
+                    if ( hdr.reclen > m_recbuf.size() )
+                        m_recbuf.resize(hdr.reclen);
+                    ring.copy_out(&m_recbuf[0], pos+sizeof(hdr), hdr.reclen);
+                    rec = m_recbuf.data();
+                }
+            }
+
+            // the record is consumed even if it can't be written
+            pos += hdr.size;
+            ++records;
+            struct consume_guard {
+                ~consume_guard() { ring.consumed(pos); delete [] external; }
+                record_ring &ring;
+                std::uint64_t pos;
+                char *external;
+            } guard{ring, pos, hdr.external};
+
+            try {
+                if ( m_options & reorder_records ) {
+                    hold(hdr, rec);
+                } else {
+                    consume(hdr, rec);
+                }
+            } catch (...) {
+                m_errors.fetch_add(1, std::memory_order_relaxed);
+                throw;
+            }
+        }
+
+        return records;
+    }
+
+    /*************************************************************************/
+    // the reordering window
+
+    // must be called with the sink locked
+    void hold(const record_header &hdr, const char *rec) {
+        // the younger records are written already, so it can't be ordered anymore
+        if ( hdr.ts < m_released_ts ) {
+            m_late_records.fetch_add(1, std::memory_order_relaxed);
+            consume(hdr, rec);
+            return;
+        }
+
+        held_record held;
+        if ( !m_held_pool.empty() ) {
+            held.rec = std::move(m_held_pool.back());
+            m_held_pool.pop_back();
+        }
+        held.hdr = hdr;
+        held.hdr.external = nullptr;
+        held.seq = m_held_seq++;
+        held.rec.assign(rec, hdr.reclen);
+
+        m_held.push_back(std::move(held));
+        std::push_heap(m_held.begin(), m_held.end());
+    }
+    // writes the held records which are older than the window, or all of them.
+    // must be called with the sink locked
+    void release_held(bool all) {
+        if ( m_held.empty() )
+            return;
+
+        const std::uint64_t now = dtf::timestamp();
+        const std::uint64_t deadline = all
+            ? UINT64_MAX
+            : (now > m_reorder_window ? now - m_reorder_window : 0)
+        ;
+        while ( !m_held.empty() && m_held.front().hdr.ts <= deadline ) {
+            std::pop_heap(m_held.begin(), m_held.end());
+            held_record held = std::move(m_held.back());
+            m_held.pop_back();
+
+            m_released_ts = held.hdr.ts;
+            consume(held.hdr, held.rec.data());
+
+            m_held_pool.push_back(std::move(held.rec));
+        }
+    }
+    void set_reorder_window(std::size_t usecs) {
+        sink_guard lock(this);
+        m_reorder_window = usecs * 1000ull;
+    }
+
+    /*************************************************************************/
+    // the per-thread buffers engine
+
+    thread_staging& staging() {
+        auto &stagings = thread_stagings::instance();
+        if ( thread_staging *st = stagings.find(m_id) )
+            return *st;
+
+        auto st = std::make_shared<thread_staging>(YAL_SESSION_BUFFER_SIZE);
+        {
+            std::lock_guard<std::mutex> lock(m_stagings_mutex);
+            m_stagings.push_back(st);
+            m_stagings_version.fetch_add(1, std::memory_order_release);
+        }
+        stagings.add(m_id, st);
+
+        return *st;
+    }
+    // round-robins over the stagings and returns the number of records written.
+    // must be called with the sink locked
+    std::size_t drain_stagings() {
+        const std::size_t version = m_stagings_version.load(std::memory_order_acquire);
+        if ( version != m_stagings_seen ) {
+            std::lock_guard<std::mutex> lock(m_stagings_mutex);
+            m_stagings_copy = m_stagings;
+            m_stagings_seen = version;
+        }
+
+        std::size_t records = 0;
+        for ( const auto &it: m_stagings_copy ) {
+            const bool orphaned = it->orphaned.load(std::memory_order_acquire);
+            records += consume_published(it->ring);
+
+            // the producer thread has exited and everything is written
+            if ( orphaned && it->ring.published() == it->ring.consumed() ) {
+                std::lock_guard<std::mutex> lock(m_stagings_mutex);
+                m_stagings.erase(std::find(m_stagings.begin(), m_stagings.end(), it));
+                m_stagings_version.fetch_add(1, std::memory_order_release);
+            }
+        }
+        // after all the stagings, so the records of any thread can take their place
+        if ( m_options & reorder_records ) {
+            release_held(false);
+        }
+
+        return records;
+    }
+    void wake_backend() {
+        {
+            std::lock_guard<std::mutex> lock(m_backend_mutex);
+            m_backend_wakeup = true;
+        }
+        m_backend_cv.notify_one();
+    }
+    void backend_run() {
+        for ( std::size_t idle = 0; ; ) {
+            std::size_t records = 0;
+            try {
+                {
+                    sink_guard lock(this);
+                    if ( m_options & per_thread_buffers ) {
+                        records = drain_stagings();
+                    } else {
+                        release_held(false);
+                    }
+                }
+                // the writers could not take the sink while it was locked above
+                drain();
+            } catch (...) {
+                defer_error(std::current_exception());
+            }
+            if ( records ) {
+                idle = 0;
+                continue;
+            }
+            if ( ++idle < 64 ) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(m_backend_mutex);
+            if ( m_backend_stop )
+                break;
+
+            m_backend_idle.store(true, std::memory_order_seq_cst);
+            m_backend_cv.wait_for(
+                 lock
+                ,std::chrono::microseconds(YAL_BACKEND_IDLE_WAIT)
+                ,[this]() { return m_backend_stop || m_backend_wakeup; }
+            );
+            m_backend_idle.store(false, std::memory_order_relaxed);
+            m_backend_wakeup = false;
+            idle = 0;
+        }
+    }
+    void stop_backend() {
+        if ( !m_backend.joinable() )
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(m_backend_mutex);
+            m_backend_stop = true;
+        }
+        m_backend_cv.notify_one();
+        m_backend.join();
+
+        std::lock_guard<std::mutex> lock(m_stagings_mutex);
+        for ( const auto &it: m_stagings ) {
+            it->closed.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    /*************************************************************************/
+
+    // writes everything published. must be called with the sink locked
+    void consume_all() {
+        consume_published(m_ring);
+        if ( m_options & per_thread_buffers ) {
+            drain_stagings();
+        }
+        if ( m_options & reorder_records ) {
+            release_held(true);
+        }
+        if ( m_options & fold_repeated ) {
+            write_repeats();
+        }
+    }
+
+    void flush() {
+        drain();
+
+        sink_guard lock(this);
+        consume_all();
+
+        rethrow_deferred();
+
+        if ( !m_volume_opened )
+            return;
+
+        m_logfile->fsync();
+        if ( m_options & create_index_file )
+            m_idxfile->fsync();
+        m_fsyncs.fetch_add(1, std::memory_order_relaxed);
+    }
+    void to_term(bool ok, const std::string &pref) {
+        sink_guard lock(this);
+        m_toterm = ok;
+        m_prefix = pref;
+    }
+
+    // can be called by any number of threads concurrently.
+    // returns false if the record was shed, dropped or spilled
+    bool write(
+         const char *fileline
+        ,std::size_t fileline_len
+        ,const char *sfileline
+        ,std::size_t sfileline_len
+        ,const char *sfunc
+        ,std::size_t sfunc_len
+        ,const char *func
+        ,std::size_t func_len
+        ,const std::string &data
+        ,const level lvl)
+    {
+        const record_parts parts(
+             m_options
+            ,dtf::timestamp()
+            ,fileline
+            ,fileline_len
+            ,sfileline
+            ,sfileline_len
+            ,sfunc
+            ,sfunc_len
+            ,func
+            ,func_len
+            ,data
+            ,lvl
+        );
+
+        return write(parts);
+    }
+    bool write(const record_parts &parts) {
+        if ( (m_options & shed_under_backlog) && shed(parts.lvl) )
+            return false;
+
+        if ( !push(parts) )
+            return false;
+
+        // since the timestamp of the record was taken, so for the global writes
+        // it also includes the writes to the previous sessions
+        const std::uint64_t now = dtf::timestamp();
+        m_stats[stats_shard::thread_index()].account(parts.lvl, parts.length(), now > parts.ts ? now - parts.ts : 0);
+
+        return true;
+    }
+    // writes the record of the logger itself, it's never shed
+    void write_note(level lvl, const char *func, const std::string &data) {
+        static const char fileline[] = "yal";
+        const record_parts parts(
+             m_options
+            ,dtf::timestamp()
+            ,fileline
+            ,sizeof(fileline)-1
+            ,fileline
+            ,sizeof(fileline)-1
+            ,func
+            ,std::strlen(func)
+            ,func
+            ,std::strlen(func)
+            ,data
+            ,lvl
+        );
+        push(parts);
+    }
+    // returns false if the record was not put into the buffer by the overflow policy
+    bool push(const record_parts &parts) {
+        bool res = false;
+        if ( m_options & per_thread_buffers ) {
+            auto wait = [this](std::size_t spins) {
+                wake_backend();
+                backoff(spins);
+            };
+            res = push(staging().ring, parts, wait);
+            if ( m_backend_idle.load(std::memory_order_seq_cst) )
+                wake_backend();
+        } else {
+            // nothing may throw between the reservation and the publication,
+            // otherwise the ring would stall. the errors are reported by the drain() below.
+            auto wait = [this](std::size_t spins) {
+                try { drain(); } catch (...) { defer_error(std::current_exception()); }
+                backoff(spins);
+            };
+            res = push(m_ring, parts, wait);
+            drain();
+        }
+
+        return res;
+    }
+    // 'wait' is called while the ring is full or the previous records are not published yet
+    template<typename F>
+    bool push(record_ring &ring, const record_parts &parts, F wait) {
+        const std::size_t reclen = parts.length();
+        const bool external = sizeof(record_header) + reclen > ring.max_record_size();
+        const std::size_t size = record_ring::aligned(sizeof(record_header) + (external ? 0 : reclen));
+
+        record_header hdr = parts.header(size);
+        std::unique_ptr<char[]> external_buf;
+        if ( external ) {
+            external_buf.reset(new char[reclen]);
+            hdr.external = external_buf.get();
+            parts.format(hdr.external);
+        }
+
+        std::uint64_t pos = 0;
+        if ( !reserve(ring, size, parts, wait, &pos) )
+            return false;
+        // now owned by the ring
+        external_buf.release();
+
+        if ( !external ) {
+            if ( char *p = ring.contiguous(pos+sizeof(hdr), reclen) ) {
+                parts.format(p);
+            } else {
+                // the record wraps around the end of the ring.
+                // the buffer never grows above the ring's max record size.
+                static thread_local std::vector<char> buf;
+                if ( reclen > buf.size() )
+                    buf.resize(ring.max_record_size());
+                parts.format(buf.data());
+                ring.copy_in(pos+sizeof(hdr), buf.data(), reclen);
+            }
+        }
+        ring.copy_in(pos, &hdr, sizeof(hdr));
+
+        ring.publish(pos, size, wait);
+
+        return true;
+    }
+
+    /*************************************************************************/
+    // the overflow policy
+
+    // reserves the space for the record, or handles it according to the overflow policy.
+    // returns false if the record is not to be written into the ring.
+    template<typename F>
+    bool reserve(record_ring &ring, std::size_t size, const record_parts &parts, F wait, std::uint64_t *pos) {
+        const auto policy = static_cast<overflow_policy>(m_overflow.load(std::memory_order_relaxed));
+        if ( policy == overflow_block ) {
+            bool blocked = false;
+            *pos = ring.reserve(size, [&blocked, &wait](std::size_t spins) { blocked = true; wait(spins); });
+            if ( blocked )
+                m_blocked_records.fetch_add(1, std::memory_order_relaxed);
+
+            return true;
+        }
+        if ( ring.try_reserve(size, pos) )
+            return true;
+
+        switch ( policy ) {
+            case overflow_block_timeout: {
+                m_blocked_records.fetch_add(1, std::memory_order_relaxed);
+                const auto timeout = std::chrono::milliseconds(m_overflow_timeout.load(std::memory_order_relaxed));
+                const auto deadline = std::chrono::steady_clock::now() + timeout;
+                for ( std::size_t spins = 0; std::chrono::steady_clock::now() < deadline; ++spins ) {
+                    wait(spins);
+                    if ( ring.try_reserve(size, pos) )
+                        return true;
+                }
+                m_dropped_records.fetch_add(1, std::memory_order_relaxed);
+
+                return false;
+            }
+            case overflow_drop_oldest: {
+                for ( std::size_t spins = 0; ; ++spins ) {
+                    if ( try_lock_sink() ) {
+                        discard_oldest(ring, size);
+                        unlock_sink();
+                    }
+                    if ( ring.try_reserve(size, pos) )
+                        return true;
+                    // the sink is writing the oldest records right now,
+                    // or the space is reserved by the records which are not published yet
+                    wait(spins);
+                }
+            }
+            case overflow_spill_to_file: {
+                spill(parts);
+                m_spilled_records.fetch_add(1, std::memory_order_relaxed);
+
+                return false;
+            }
+            default: {
+                m_dropped_records.fetch_add(1, std::memory_order_relaxed);
+
+                return false;
+            }
+        }
+    }
+    // drops the oldest published records until there are 'size' free bytes.
+    // must be called with the sink locked
+    void discard_oldest(record_ring &ring, std::size_t size) {
+        const std::uint64_t published = ring.published();
+        std::uint64_t pos = ring.consumed();
+        while ( pos != published && ring.capacity() - ring.depth() < size ) {
+            record_header hdr;
+            ring.copy_out(&hdr, pos, sizeof(hdr));
+            delete [] hdr.external;
+
+            pos += hdr.size;
+            ring.consumed(pos);
+            m_dropped_records.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    // appends the record to '<name>.overflow' file, which isn't a part of the volumes
+    void spill(const record_parts &parts) {
+        static thread_local std::vector<char> buf;
+        buf.resize(parts.length());
+        parts.format(buf.data());
+
+        std::lock_guard<std::mutex> lock(m_spill_mutex);
+        if ( !m_spill_file ) {
+            const auto pair = split_name(m_path, m_name);
+            const std::string fname = pair.first + "/" + pair.second + ".overflow";
+            m_spill_file.reset(create_private(fname, true));
+            __YAL_THROW_IF(!m_spill_file, "can't open overflow file \"" +fname+ "\"");
+        }
+        __YAL_THROW_IF(std::fwrite(buf.data(), 1, buf.size(), m_spill_file.get()) != buf.size(), "overflow file write error");
+    }
+    void set_overflow(overflow_policy policy, std::size_t timeout) {
+        m_overflow_timeout.store(timeout, std::memory_order_relaxed);
+        m_overflow.store(policy, std::memory_order_relaxed);
+    }
+
+    /*************************************************************************/
+    // the load shedding
+
+    // returns true if the record must be dropped because the buffer is too deep
+    bool shed(level lvl) {
+        const record_ring &ring = (m_options & per_thread_buffers) ? staging().ring : m_ring;
+        const std::size_t depth = std::max(ring.depth() * 100 / ring.capacity(), shed_pressure());
+
+        // the number of the shed levels: info, then debug, then warning, never error
+        static const std::size_t thresholds[] = {0, YAL_SHED_INFO_DEPTH, YAL_SHED_DEBUG_DEPTH, YAL_SHED_WARNING_DEPTH};
+        std::size_t state = m_shed_state.load(std::memory_order_relaxed);
+        std::size_t next = state;
+        while ( next < 3 && depth >= thresholds[next+1] )
+            ++next;
+        // restore the levels one by one, when the pressure subsides
+        if ( next == state && next > 0 && depth < thresholds[next] / 2 )
+            --next;
+        if ( next != state && m_shed_state.compare_exchange_strong(state, next, std::memory_order_relaxed) ) {
+            report_shedding(next);
+        }
+
+        if ( lvl == yal::error || static_cast<std::size_t>(lvl) + next < 5 )
+            return false;
+
+        m_shed[lvl - yal::warning].fetch_add(1, std::memory_order_relaxed);
+
+        return true;
+    }
+    // the pressure of the latency and throughput limits. it's sampled by one of the
+    // writers every YAL_SHED_SAMPLE_INTERVAL milliseconds, the others use the last sample.
+    std::size_t shed_pressure() {
+        const std::uint64_t p99_limit = m_shed_p99.load(std::memory_order_relaxed);
+        const std::uint64_t rate_limit = m_shed_rate.load(std::memory_order_relaxed);
+        if ( !p99_limit && !rate_limit )
+            return 0;
+
+        const std::uint64_t now = dtf::timestamp();
+        std::uint64_t prev_ts = m_shed_sample_ts.load(std::memory_order_relaxed);
+        if ( now < prev_ts + YAL_SHED_SAMPLE_INTERVAL * 1000000ull
+            || !m_shed_sample_ts.compare_exchange_strong(prev_ts, now, std::memory_order_relaxed) )
+        {
+            return m_shed_pressure.load(std::memory_order_relaxed);
+        }
+
+        session_stats cur;
+        for ( std::size_t idx = 0; idx < YAL_STATS_SHARDS; ++idx ) {
+            m_stats[idx].collect(&cur);
+        }
+
+        std::lock_guard<std::mutex> lock(m_shed_mutex);
+        // of the writes since the previous sample
+        latency_histogram hist;
+        hist.max = cur.latency.max;
+        for ( std::size_t idx = 0; idx < latency_histogram::buckets; ++idx ) {
+            hist.counts[idx] = cur.latency.counts[idx] - m_shed_prev.latency.counts[idx];
+            hist.total += hist.counts[idx];
+        }
+        const std::uint64_t p99 = hist.total ? hist.percentile(0.99) : 0;
+        const std::uint64_t rate = (cur.total_bytes() - m_shed_prev.total_bytes()) * 1000000000ull / (now - prev_ts);
+        m_shed_prev = cur;
+
+        std::size_t pressure = 0;
+        if ( p99_limit )
+            pressure = std::max<std::uint64_t>(pressure, p99 * YAL_SHED_INFO_DEPTH / p99_limit);
+        if ( rate_limit )
+            pressure = std::max<std::uint64_t>(pressure, rate * YAL_SHED_INFO_DEPTH / rate_limit);
+        m_shed_pressure.store(pressure, std::memory_order_relaxed);
+
+        return pressure;
+    }
+    void set_shed_limits(std::size_t p99_usecs, std::size_t bytes_per_sec) {
+        {
+            std::lock_guard<std::mutex> lock(m_shed_mutex);
+            m_shed_prev = stats();
+            m_shed_sample_ts.store(dtf::timestamp(), std::memory_order_relaxed);
+            m_shed_pressure.store(0, std::memory_order_relaxed);
+        }
+        m_shed_p99.store(p99_usecs * 1000ull, std::memory_order_relaxed);
+        m_shed_rate.store(bytes_per_sec, std::memory_order_relaxed);
+    }
+    void report_shedding(std::size_t state) {
+        static const char *const shed_levels[] = {"no", "info", "info and debug", "info, debug and warning"};
+
+        std::uint64_t counts[3];
+        {
+            std::lock_guard<std::mutex> lock(m_shed_mutex);
+            for ( std::size_t idx = 0; idx < 3; ++idx ) {
+                const std::uint64_t total = m_shed[idx].load(std::memory_order_relaxed);
+                counts[idx] = total - m_shed_reported[idx];
+                m_shed_reported[idx] = total;
+            }
+        }
+
+        write_note(
+             yal::warning
+            ,"shedding"
+            ,fmt::format(
+                 "load shedding: dropping {} records, dropped since the last report: info={} debug={} warning={}"
+                ,shed_levels[state]
+                ,counts[yal::info - yal::warning]
+                ,counts[yal::debug - yal::warning]
+                ,counts[yal::warning - yal::warning]
+            )
+        );
+    }
+    std::uint64_t shed_records() const {
+        std::uint64_t total = 0;
+        for ( const auto &it: m_shed ) {
+            total += it.load(std::memory_order_relaxed);
+        }
+
+        return total;
+    }
+
+    /*************************************************************************/
+    // the telemetry
+
+    session_stats stats() {
+        session_stats res;
+        res.name = m_name;
+        for ( std::size_t idx = 0; idx < YAL_STATS_SHARDS; ++idx ) {
+            m_stats[idx].collect(&res);
+        }
+        res.rotations = m_rotations.load(std::memory_order_relaxed);
+        res.fsyncs = m_fsyncs.load(std::memory_order_relaxed);
+        res.errors = m_errors.load(std::memory_order_relaxed);
+        res.dropped = m_dropped_records.load(std::memory_order_relaxed);
+        res.blocked = m_blocked_records.load(std::memory_order_relaxed);
+        res.spilled = m_spilled_records.load(std::memory_order_relaxed);
+        res.shed = shed_records();
+        res.late = m_late_records.load(std::memory_order_relaxed);
+        res.over_budget = m_over_budget_records.load(std::memory_order_relaxed);
+        res.downgraded = m_downgraded_records.load(std::memory_order_relaxed);
+
+        res.queue_depth = m_ring.depth();
+        std::lock_guard<std::mutex> lock(m_stagings_mutex);
+        for ( const auto &it: m_stagings ) {
+            res.queue_depth += it->ring.depth();
+        }
+
+        return res;
+    }
+
+    /*************************************************************************/
+    // the folding of the repeated records
+
+    static std::uint64_t data_hash(const char *p, std::size_t len) {
+        std::uint64_t hash = 14695981039346656037ull; // FNV-1a
+        for ( const char *end = p+len; p != end; ++p ) {
+            hash = (hash ^ static_cast<unsigned char>(*p)) * 1099511628211ull;
+        }
+
+        return hash;
+    }
+
+    // writes one record to the volume. must be called with the sink locked
+    void consume(const record_header &hdr, const char *rec) {
+        if ( !(m_options & fold_repeated) ) {
+            write_record(hdr, rec);
+            return;
+        }
+
+        const std::uint64_t hash = data_hash(rec+hdr.reclen-1-hdr.data_len, hdr.data_len);
+        fold_state &f = m_fold;
+        if ( f.valid && f.fileline == hdr.fileline && f.lvl == hdr.lvl && f.data_len == hdr.data_len && f.hash == hash ) {
+            if ( !f.repeats ) {
+                f.first_ts = hdr.ts;
+                f.hdr = hdr;
+                f.prefix.assign(rec, hdr.reclen-hdr.data_len-1);
+            }
+            ++f.repeats;
+            f.last_ts = hdr.ts;
+            return;
+        }
+
+        write_repeats();
+        write_record(hdr, rec);
+
+        f.valid = true;
+        f.fileline = hdr.fileline;
+        f.lvl = hdr.lvl;
+        f.data_len = hdr.data_len;
+        f.hash = hash;
+    }
+    // writes the "last message repeated" record for the folded records, if any.
+    // must be called with the sink locked
+    void write_repeats() {
+        fold_state &f = m_fold;
+        if ( !f.repeats )
+            return;
+
+        char first[dtf::bufsize], last[dtf::bufsize];
+        const std::size_t dtflags = record_parts::dt_flags(m_options);
+        const std::size_t first_len = dtf::timestamp_to_chars(first, f.first_ts, dtflags);
+        const std::size_t last_len = dtf::timestamp_to_chars(last, f.last_ts, dtflags);
+        const std::string data = fmt::format(
+             "last message repeated {} times ({}..{})"
+            ,f.repeats
+            ,fmt::string_view(first, first_len)
+            ,fmt::string_view(last, last_len)
+        );
+        f.repeats = 0;
+
+        std::string rec = f.prefix;
+        rec += data;
+        rec += '\n';
+
+        record_header hdr = f.hdr;
+        hdr.ts = f.last_ts;
+        hdr.external = nullptr;
+        hdr.reclen = static_cast<std::uint32_t>(rec.length());
+        hdr.data_len = static_cast<std::uint32_t>(data.length());
+        write_record(hdr, rec.data());
+    }
+
+    void write_record(const record_header &hdr, const char *rec) {
+        // the record belongs to the next time interval
+        if ( hdr.ts >= m_next_rotation_ts && m_volume_opened ) {
+            rotate_volume();
+        }
+
+        if ( m_budget_rate && !charge_budget(hdr.ts, hdr.reclen) ) {
+            if ( m_budget_policy == budget_downgrade ) {
+                // the record shortened to its first bytes, if the budget allows it
+                const std::size_t keep = YAL_BUDGET_DOWNGRADE_LEN;
+                if ( hdr.data_len > keep ) {
+                    static const char ellipsis[] = "...\n";
+                    const std::size_t prefix_len = hdr.reclen - hdr.data_len - 1;
+                    std::string shortened(rec, prefix_len + keep);
+                    shortened.append(ellipsis, sizeof(ellipsis)-1);
+                    if ( charge_budget(hdr.ts, shortened.length()) ) {
+                        record_header short_hdr = hdr;
+                        short_hdr.reclen = static_cast<std::uint32_t>(shortened.length());
+                        short_hdr.data_len = static_cast<std::uint32_t>(keep + sizeof(ellipsis)-2);
+                        m_downgraded_records.fetch_add(1, std::memory_order_relaxed);
+                        write_volume(short_hdr, shortened.data());
+
+                        return;
+                    }
+                }
+            }
+            m_over_budget_records.fetch_add(1, std::memory_order_relaxed);
+
+            return;
+        }
+
+        write_volume(hdr, rec);
+    }
+    // takes 'bytes' from the token bucket, which is refilled by the records timestamps.
+    // must be called with the sink locked
+    bool charge_budget(std::uint64_t ts, std::size_t bytes) {
+        if ( ts > m_budget_ts ) {
+            const double refill = static_cast<double>(ts - m_budget_ts) * m_budget_rate / 1e9;
+            m_budget_tokens = std::min(static_cast<double>(m_budget_burst), m_budget_tokens + refill);
+            m_budget_ts = ts;
+        }
+        if ( m_budget_tokens < static_cast<double>(bytes) )
+            return false;
+
+        m_budget_tokens -= static_cast<double>(bytes);
+
+        return true;
+    }
+    void set_budget(std::size_t bytes_per_sec, std::size_t burst, budget_policy policy) {
+        sink_guard lock(this);
+        m_budget_rate = bytes_per_sec;
+        m_budget_burst = std::max(burst, bytes_per_sec ? std::size_t(1) : std::size_t(0));
+        m_budget_policy = policy;
+        m_budget_tokens = static_cast<double>(m_budget_burst);
+        m_budget_ts = dtf::timestamp();
+    }
+
+    // writes the record as it's kept by the budget
+    void write_volume(const record_header &hdr, const char *rec) {
+        const level lvl = static_cast<level>(hdr.lvl);
+
+        if ( m_toterm ) {
+            FILE *term = ((lvl == yal::info || lvl == yal::debug) ? stdout : stderr);
+            if ( !m_prefix.empty() ) {
+                std::fprintf(term, "<%s>%.*s", m_prefix.c_str(), static_cast<int>(hdr.reclen), rec);
+            } else {
+                std::fwrite(rec, 1, hdr.reclen, term);
+            }
+            std::fflush(term);
+        }
+
+        if ( !m_volume_opened ) {
+            if ( m_name == "disable" )
+                return;
+
+            open_volume();
+        }
+
+        if ( m_options & create_index_file ) {
+            const std::uint32_t off = static_cast<std::uint32_t>(m_logfile->fpos());
+            const index_record record = {
+                off // start
+                ,1 // dt_off
+                ,static_cast<std::uint8_t>(hdr.dt_len) // dt_len
+                ,2 // lvl_off
+                ,1 // lvl_len
+                ,2 // fl_off
+                ,static_cast<std::uint8_t>(hdr.fileline_len) // fl_len
+                ,2 // func_off
+                ,static_cast<std::uint8_t>(hdr.func_len) // func_len
+                ,3 // data_off
+                ,static_cast<std::uint32_t>(hdr.data_len+1/*for '\n' */) // data_len
+            };
+
+            m_idxfile->write(&record, sizeof(record));
+        }
+
+        std::size_t wrlen = hdr.reclen;
+        if ( m_proc ) {
+            const auto proc_res = m_proc(rec, hdr.reclen);
+            m_logfile->write(proc_res.first, proc_res.second);
+            wrlen = proc_res.second;
+        } else {
+            m_logfile->write(rec, hdr.reclen);
+        }
+
+        if ( m_options & create_summary_file ) {
+            update_summary(hdr.fileline, hdr.ts, lvl, hdr.reclen, wrlen);
+        }
+
+        if ( m_options & fsync_each_record ) {
+            m_logfile->fsync();
+            if ( m_options & create_index_file ) {
+                m_idxfile->fsync();
+            }
+            m_fsyncs.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        m_writen_bytes += hdr.reclen;
+        if ( m_writen_bytes >= m_volume_size ) {
+            rotate_volume();
+        }
+    }
+
+    void rotate_volume() {
+        m_rotations.fetch_add(1, std::memory_order_relaxed);
+        m_writen_bytes = 0;
+        close_volume();
+        m_volume_number += 1;
+        create_volume();
+    }
+
+    // the boundaries are aligned to the interval since the epoch(UTC)
+    void update_rotation_time(std::uint64_t now) {
+        m_next_rotation_ts = m_rotation_interval
+            ? (now / m_rotation_interval + 1) * m_rotation_interval
+            : UINT64_MAX
+        ;
+    }
+    void set_retention(const retention_policy &policy) {
+        if ( !m_inventory )
+            return;
+
+        m_inventory->policy(policy);
+        housekeeper::instance().session_policy();
+    }
+
+    void set_rotation_interval(std::size_t secs) {
+        sink_guard lock(this);
+        m_rotation_interval = secs * 1000000000ull;
+        update_rotation_time(dtf::timestamp());
+    }
+
+    const std::string        m_path;
+    const std::string        m_name;
+    const std::size_t        m_volume_size;
+    const std::size_t        m_options;
+    const process_buffer     m_proc;
+    const io_factory         m_io; // may be empty
+    std::unique_ptr<io_base> m_logfile;
+    std::unique_ptr<io_base> m_idxfile;
+    bool                     m_toterm;
+    std::string              m_prefix;
+    session_registry        *m_registry; // null if the session isn't created by a manager
+    std::string              m_recbuf;
+    std::size_t              m_writen_bytes;
+    std::size_t              m_volume_number;
+    volume_summary           m_summary;
+    const char              *m_last_callsite;
+    std::unordered_set<const char*> m_callsites;
+    const std::string        m_manifest_fname;
+    bool                     m_volume_opened;
+    std::future<volume_files> m_next_volume;
+    std::unique_ptr<bg_worker> m_worker;
+    std::uint64_t            m_rotation_interval; // in nanoseconds
+    std::uint64_t            m_next_rotation_ts;
+    std::shared_ptr<volume_inventory> m_inventory; // null for the "disable" session
+    record_ring              m_ring;
+    std::atomic<bool>        m_sink_busy;
+
+    // the per-thread buffers engine
+    const std::uint64_t      m_id; // the stagings of the threads are keyed by it
+    std::mutex               m_stagings_mutex;
+    std::vector<std::shared_ptr<thread_staging>> m_stagings;
+    std::atomic<std::size_t> m_stagings_version;
+    std::vector<std::shared_ptr<thread_staging>> m_stagings_copy; // used only by the sink
+    std::size_t              m_stagings_seen;
+    std::mutex               m_backend_mutex;
+    std::condition_variable  m_backend_cv;
+    std::atomic<bool>        m_backend_idle;
+    bool                     m_backend_wakeup;
+    bool                     m_backend_stop;
+    std::exception_ptr       m_backend_error; // see defer_error()
+    std::atomic<bool>        m_error_deferred;
+    std::thread              m_backend;
+
+    // the reordering window
+    std::vector<held_record> m_held; // the min-heap by the timestamp
+    std::vector<std::string> m_held_pool; // the buffers of the released records
+    std::uint64_t            m_held_seq;
+    std::uint64_t            m_released_ts; // of the last released record
+    std::uint64_t            m_reorder_window; // in nanoseconds
+    std::atomic<std::uint64_t> m_late_records;
+
+    // the folding of the repeated records
+    struct fold_state {
+        fold_state()
+            :valid(false)
+            ,fileline(nullptr)
+            ,lvl(0)
+            ,data_len(0)
+            ,hash(0)
+            ,repeats(0)
+            ,first_ts(0)
+            ,last_ts(0)
+            ,hdr()
+            ,prefix()
+        {}
+
+        // identifies the last written record
+        bool          valid;
+        const char   *fileline;
+        std::uint8_t  lvl;
+        std::uint32_t data_len;
+        std::uint64_t hash; // of the data
+        // the folded records
+        std::size_t   repeats;
+        std::uint64_t first_ts;
+        std::uint64_t last_ts;
+        record_header hdr; // of the first one
+        std::string   prefix; // of the first one, the text before the data
+    };
+    fold_state               m_fold;
+
+    // the overflow policy
+    struct file_closer {
+        void operator()(std::FILE *f) const { std::fclose(f); }
+    };
+    std::atomic<std::uint8_t> m_overflow;
+    std::atomic<std::size_t> m_overflow_timeout; // in milliseconds
+    std::atomic<std::uint64_t> m_dropped_records;
+    std::atomic<std::uint64_t> m_blocked_records;
+    std::atomic<std::uint64_t> m_spilled_records;
+    std::mutex               m_spill_mutex;
+    std::unique_ptr<std::FILE, file_closer> m_spill_file;
+
+    // the bytes per second budget, used only by the sink
+    std::size_t              m_budget_rate; // zero if unlimited
+    std::size_t              m_budget_burst;
+    budget_policy            m_budget_policy;
+    double                   m_budget_tokens;
+    std::uint64_t            m_budget_ts; // of the last refill
+    std::atomic<std::uint64_t> m_over_budget_records;
+    std::atomic<std::uint64_t> m_downgraded_records;
+
+    // the load shedding
+    std::atomic<std::size_t> m_shed_state; // the number of the shed levels
+    std::atomic<std::uint64_t> m_shed[3]; // by level, from warning
+    std::mutex               m_shed_mutex;
+    std::uint64_t            m_shed_reported[3];
+    std::atomic<std::uint64_t> m_shed_p99;  // in nanoseconds, zero if disabled
+    std::atomic<std::uint64_t> m_shed_rate; // bytes per second, zero if disabled
+    std::atomic<std::size_t> m_shed_pressure; // of the limits, as a buffer depth in percents
+    std::atomic<std::uint64_t> m_shed_sample_ts;
+    session_stats            m_shed_prev; // at the previous sample, under 'm_shed_mutex'
+
+    // the telemetry
+    std::unique_ptr<stats_shard[]> m_stats; // YAL_STATS_SHARDS of them
+    std::atomic<std::uint64_t> m_rotations; // the next ones are updated only by the sink
+    std::atomic<std::uint64_t> m_fsyncs;
+    std::atomic<std::uint64_t> m_errors;
+
+    static std::uint64_t next_id() {
+        static std::atomic<std::uint64_t> id(0);
+
+        return ++id;
+    }
+};
+
+/***************************************************************************/
+
+session::session(
+     const std::string &path
+    ,const std::string &name
+    ,std::size_t volume_size
+    ,std::size_t opts
+    ,process_buffer proc
+    ,std::size_t volume_number
+    ,io_factory io
+)
+    :pimpl(new impl(path, name, volume_size, opts, std::move(proc), volume_number, std::move(io)))
+    ,m_level_pad0()
+    ,m_level(name != "disable" ? yal::info : yal::disable)
+    ,m_level_pad1()
+{}
+
+session::~session()
+{}
+
+/***************************************************************************/
+
+const std::string& session::name() const { return pimpl->m_name; }
+std::size_t session::flags() const { return pimpl->m_options; }
+std::size_t session::volume_size() const { return pimpl->m_volume_size; }
+void session::to_term(const bool ok, const std::string &pref) { pimpl->to_term(ok, pref); }
+std::size_t session::rotation_interval() const { return pimpl->m_rotation_interval / 1000000000ull; }
+void session::rotation_interval(std::size_t secs) { pimpl->set_rotation_interval(secs); }
+std::size_t session::reorder_window() const { return pimpl->m_reorder_window / 1000ull; }
+void session::reorder_window(std::size_t usecs) { pimpl->set_reorder_window(usecs); }
+std::uint64_t session::late_records() const { return pimpl->m_late_records.load(std::memory_order_relaxed); }
+std::uint64_t session::shed_records() const { return pimpl->shed_records(); }
+void session::overflow(overflow_policy policy, std::size_t timeout) { pimpl->set_overflow(policy, timeout); }
+overflow_policy session::overflow() const { return static_cast<overflow_policy>(pimpl->m_overflow.load(std::memory_order_relaxed)); }
+std::uint64_t session::dropped_records() const { return pimpl->m_dropped_records.load(std::memory_order_relaxed); }
+std::uint64_t session::blocked_records() const { return pimpl->m_blocked_records.load(std::memory_order_relaxed); }
+std::uint64_t session::spilled_records() const { return pimpl->m_spilled_records.load(std::memory_order_relaxed); }
+void session::budget(std::size_t bytes_per_sec, std::size_t burst, budget_policy policy) { pimpl->set_budget(bytes_per_sec, burst, policy); }
+void session::shed_limits(std::size_t p99_usecs, std::size_t bytes_per_sec) { pimpl->set_shed_limits(p99_usecs, bytes_per_sec); }
+std::uint64_t session::over_budget_records() const { return pimpl->m_over_budget_records.load(std::memory_order_relaxed); }
+std::uint64_t session::downgraded_records() const { return pimpl->m_downgraded_records.load(std::memory_order_relaxed); }
+session_stats session::stats() const { return pimpl->stats(); }
+
+bool session::write(
+     const char *fileline
+    ,const std::size_t fileline_len
+    ,const char *sfileline
+    ,const std::size_t sfileline_len
+    ,const char *sfunc
+    ,const std::size_t sfunc_len
+    ,const char *func
+    ,const std::size_t func_len
+    ,const std::string &data
+    ,const level lvl)
+{
+    return pimpl->write(fileline, fileline_len, sfileline, sfileline_len, sfunc, sfunc_len, func, func_len, data, lvl);
+}
+
+void session::flush() { pimpl->flush(); }
+
+void session::retention(const retention_policy &policy) { pimpl->set_retention(policy); }
+
+/***************************************************************************/
+/***************************************************************************/
+/***************************************************************************/
+
+// the read-side state of a thread, written only by that thread so the readers
+// share no cache line. 'seq' is odd while the thread reads a registry snapshot.
+struct reader_slot {
+    reader_slot()
+        :seq(0)
+        ,depth(0)
+    {}
+
+    std::atomic<std::uint64_t> seq;
+    std::size_t depth; // of the nested reads
+    char pad[record_ring::cacheline]; // from the slot of the next thread
+};
+
+// the slots of all the threads, scanned by the registry writers
+struct reader_slots {
+    static reader_slots& instance() {
+        static reader_slots object;
+
+        return object;
+    }
+
+    std::mutex mutex;
+    std::vector<reader_slot*> list;
+};
+
+// registers the slot of the current thread on its first read
+struct thread_reader {
+    thread_reader()
+        :slot()
+    {
+        auto &slots = reader_slots::instance();
+        std::lock_guard<std::mutex> lock(slots.mutex);
+        slots.list.push_back(&slot);
+    }
+    ~thread_reader() {
+        auto &slots = reader_slots::instance();
+        std::lock_guard<std::mutex> lock(slots.mutex);
+        slots.list.erase(std::find(slots.list.begin(), slots.list.end(), &slot));
+    }
+
+    static reader_slot& instance() {
+        static thread_local thread_reader object;
+
+        return object.slot;
+    }
+
+    reader_slot slot;
+};
+
+// the live sessions, read without locks by the global writes.
+// the list is an immutable snapshot replaced on each create/destroy. the replaced
+// snapshot is freed when the threads which were reading at the replacement are done.
+struct session_registry {
+    struct entry {
+        std::string name;
+        session    *ptr;
+        std::weak_ptr<session> weak; // for get(), the global writes use 'ptr'
+    };
+    using snapshot = std::vector<entry>; // sorted by name
+
+    // 'max_level' is kept equal to the most verbose level of the sessions
+    explicit session_registry(std::atomic<std::uint8_t> &max_level)
+        :m_mutex()
+        ,m_current(new snapshot)
+        ,m_max_level(max_level)
+    {}
+    ~session_registry() {
+        delete m_current.load(std::memory_order_relaxed);
+    }
+
+    // the sessions of the snapshot can't be destroyed while 'func' runs
+    template<typename F>
+    void read(F func) const {
+        reader_slot &slot = thread_reader::instance();
+        struct guard {
+            ~guard() {
+                if ( --slot.depth == 0 )
+                    slot.seq.store(slot.seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            }
+            reader_slot &slot;
+        } lock{slot};
+        // pairs with the exchange and the slot load in publish(): either the writer
+        // sees this thread reading, or this thread sees the new snapshot
+        if ( slot.depth++ == 0 )
+            slot.seq.store(slot.seq.load(std::memory_order_relaxed) + 1, std::memory_order_seq_cst);
+
+        func(*m_current.load(std::memory_order_seq_cst));
+    }
+
+    void add(const std::shared_ptr<session> &s) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        const snapshot &cur = *m_current.load(std::memory_order_relaxed);
+        snapshot *next = new snapshot;
+        next->reserve(cur.size()+1);
+        entry e{s->name(), s.get(), s};
+        auto pos = std::lower_bound(cur.begin(), cur.end(), e.name, less);
+        next->insert(next->end(), cur.begin(), pos);
+        next->push_back(std::move(e));
+        next->insert(next->end(), pos, cur.end());
+
+        publish(next);
+        update_max_level_locked();
+    }
+    // waits until no reader can see the session
+    void remove(const session *s) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        const snapshot &cur = *m_current.load(std::memory_order_relaxed);
+        auto pos = std::find_if(cur.begin(), cur.end(), [s](const entry &e) { return e.ptr == s; });
+        if ( pos == cur.end() )
+            return;
+
+        snapshot *next = new snapshot;
+        next->reserve(cur.size()-1);
+        next->insert(next->end(), cur.begin(), pos);
+        next->insert(next->end(), pos+1, cur.end());
+
+        publish(next);
+        update_max_level_locked();
+    }
+    void update_max_level() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        update_max_level_locked();
+    }
+
+    static bool less(const entry &e, const std::string &name) { return e.name < name; }
+
+private:
+    void update_max_level_locked() {
+        level max = yal::disable;
+        for ( const auto &it: *m_current.load(std::memory_order_relaxed) ) {
+            max = std::max(max, it.ptr->get_level());
+        }
+        m_max_level.store(static_cast<std::uint8_t>(max), std::memory_order_relaxed);
+    }
+    void publish(snapshot *next) {
+        snapshot *prev = m_current.exchange(next, std::memory_order_seq_cst);
+
+        // only the reads started before the exchange can see 'prev'. a reader can be
+        // in the disk I/O of a session write, so sleep rather than spin while waiting for it
+        auto &slots = reader_slots::instance();
+        std::lock_guard<std::mutex> lock(slots.mutex);
+        for ( const reader_slot *it: slots.list ) {
+            const std::uint64_t seq = it->seq.load(std::memory_order_seq_cst);
+            if ( !(seq & 1u) )
+                continue;
+
+            for ( std::size_t spins = 0; it->seq.load(std::memory_order_acquire) == seq; ++spins ) {
+                if ( spins < 1024 ) {
+                    backoff(spins);
+                } else {
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+            }
+        }
+
+        delete prev;
+    }
+
+    std::mutex m_mutex; // for the writers
+    std::atomic<snapshot*> m_current;
+    std::atomic<std::uint8_t> &m_max_level;
+};
+
+void session::set_level(const level lvl) {
+    m_level.store(static_cast<std::uint8_t>(lvl), std::memory_order_relaxed);
+    if ( pimpl->m_registry )
+        pimpl->m_registry->update_max_level();
+}
+
+/***************************************************************************/
+
+// unregisters the session before destroying it
+struct session_deleter {
+    void operator()(session *s) const {
+        registry->remove(s);
+        delete s;
+    }
+
+    std::shared_ptr<session_registry> registry;
+};
+
+/***************************************************************************/
+
+#ifndef _WIN32
+
+// writes the metrics of all the sessions in the Prometheus text format every 'interval'
+// milliseconds. the target is a file(replaced atomically), or 'unix:<path>' - the socket
+// sending the last metrics to each connected client.
+struct metrics_exporter {
+    metrics_exporter(std::shared_ptr<session_registry> sessions, const std::string &target, std::size_t interval)
+        :m_sessions(std::move(sessions))
+        ,m_fname()
+        ,m_sockname()
+        ,m_interval(std::max<std::size_t>(interval, 1))
+        ,m_listen(-1)
+        ,m_wakeup{-1, -1}
+        ,m_text()
+        ,m_prev()
+        ,m_prev_ts(0)
+        ,m_thread()
+    {
+        static const char unix_prefix[] = "unix:";
+        if ( target.compare(0, sizeof(unix_prefix)-1, unix_prefix) == 0 ) {
+            m_sockname = target.substr(sizeof(unix_prefix)-1);
+            m_listen = unix_listen(m_sockname);
+        } else {
+            m_fname = target;
+        }
+
+        if ( ::pipe(m_wakeup) != 0 ) {
+            close_fds();
+            __YAL_THROW_IF(true, "can't create the wakeup pipe of the metrics exporter");
+        }
+
+        m_thread = std::thread(&metrics_exporter::run, this);
+    }
+    ~metrics_exporter() {
+        const char stop = 0;
+        while ( ::write(m_wakeup[1], &stop, 1) == -1 && errno == EINTR )
+            ;
+        m_thread.join();
+
+        close_fds();
+        if ( !m_sockname.empty() )
+            ::unlink(m_sockname.c_str());
+    }
+
+private:
+    static int unix_listen(const std::string &path) {
+        ::sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        __YAL_THROW_IF(path.empty() || path.size() >= sizeof(addr.sun_path), "bad unix socket path \""+path+"\"");
+        std::memcpy(addr.sun_path, path.c_str(), path.size());
+
+        const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        __YAL_THROW_IF(fd == -1, "can't create unix socket");
+
+        ::unlink(path.c_str()); // the socket of the previous run
+        // owner-only before the listen(), so nobody else can connect in between
+        if ( ::bind(fd, reinterpret_cast<const ::sockaddr*>(&addr), sizeof(addr)) != 0
+            || ::chmod(path.c_str(), S_IRUSR|S_IWUSR) != 0
+            || ::listen(fd, 16) != 0 )
+        {
+            const int ec = errno;
+            ::close(fd);
+            errno = ec;
+            __YAL_THROW_IF(true, "can't listen on unix socket \""+path+"\"");
+        }
+
+        return fd;
+    }
+    void close_fds() {
+        for ( int fd: {m_listen, m_wakeup[0], m_wakeup[1]} ) {
+            if ( fd != -1 )
+                ::close(fd);
+        }
+    }
+
+    void run() {
+        auto next = std::chrono::steady_clock::now();
+        while ( true ) {
+            auto now = std::chrono::steady_clock::now();
+            if ( now >= next ) {
+                update(dtf::timestamp());
+                next = now + std::chrono::milliseconds(m_interval);
+            }
+
+            ::pollfd fds[2] = {{m_wakeup[0], POLLIN, 0}, {m_listen, POLLIN, 0}};
+            const auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count() + 1;
+            if ( ::poll(fds, m_listen != -1 ? 2 : 1, static_cast<int>(timeout)) <= 0 )
+                continue;
+            if ( fds[0].revents )
+                break;
+            if ( fds[1].revents & POLLIN )
+                serve();
+        }
+    }
+    // sends the last metrics to the connected client. the errors are ignored.
+    void serve() {
+        const int fd = ::accept(m_listen, nullptr, nullptr);
+        if ( fd == -1 )
+            return;
+
+        // a stuck client can't stop the exporter
+        ::timeval tv{1, 0};
+        ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        for ( std::size_t off = 0; off < m_text.size(); ) {
+#ifdef MSG_NOSIGNAL
+            const ::ssize_t n = ::send(fd, m_text.data()+off, m_text.size()-off, MSG_NOSIGNAL);
+#else
+            const ::ssize_t n = ::send(fd, m_text.data()+off, m_text.size()-off, 0);
+#endif // MSG_NOSIGNAL
+            if ( n <= 0 )
+                break;
+            off += static_cast<std::size_t>(n);
+        }
+        ::close(fd);
+    }
 
-        if ( reclen > m_recbuf.size() )
-            m_recbuf.resize(reclen);
+    // the state of a session at the previous update, for the per-second rates
+    struct previous {
+        std::uint64_t records;
+        std::uint64_t bytes;
+        std::vector<std::uint64_t> latency;
+    };
+
+    void update(std::uint64_t now) {
+        std::vector<session_stats> stats;
+        m_sessions->read(
+            [&stats](const session_registry::snapshot &snap) {
+                for ( const auto &it: snap ) {
+                    stats.push_back(it.ptr->stats());
+                }
+            }
+        );
 
-        const char lvlchr = level_chr(lvl);
+        // the rates and the quantiles are for the interval since the previous update
+        const double secs = m_prev_ts && now > m_prev_ts ? static_cast<double>(now - m_prev_ts) / 1e9 : 0;
+        std::vector<double> rates[2];
+        std::vector<latency_histogram> latency(stats.size());
+        std::map<std::string, previous> prev;
+        for ( std::size_t idx = 0; idx < stats.size(); ++idx ) {
+            const session_stats &st = stats[idx];
+            previous cur{st.total_records(), st.total_bytes(), std::vector<std::uint64_t>(st.latency.counts, st.latency.counts+latency_histogram::buckets)};
+
+            auto it = m_prev.find(st.name);
+            const bool known = secs > 0 && it != m_prev.end();
+            rates[0].push_back(known ? static_cast<double>(cur.records - it->second.records) / secs : 0);
+            rates[1].push_back(known ? static_cast<double>(cur.bytes - it->second.bytes) / secs : 0);
+
+            latency_histogram &hist = latency[idx];
+            hist.max = st.latency.max;
+            for ( std::size_t bucket = 0; bucket < latency_histogram::buckets; ++bucket ) {
+                hist.counts[bucket] = cur.latency[bucket] - (it != m_prev.end() ? it->second.latency[bucket] : 0);
+                hist.total += hist.counts[bucket];
+            }
 
-        /*********************************************/
-        char *p = const_cast<char*>(m_recbuf.c_str());
-        *p++ = '[';
-        std::memcpy(p, dtbuf, dtlen);
-        p += dtlen;
-        *p++ = ']';
-        *p++ = '[';
-        *p++ = lvlchr;
-        *p++ = ']';
-        *p++ = '[';
-        std::memcpy(p, fileline, fileline_len);
-        p += fileline_len;
-        *p++ = ']';
-        *p++ = '[';
-        std::memcpy(p, lfunc_name, lfunc_len);
-        p += lfunc_len;
-        *p++ = ']';
-        *p++ = ':';
-        *p++ = ' ';
-        std::memcpy(p, data.c_str(), data.length());
-        p += data.length();
-        *p++ = '\n';
-        *p = 0;
-        /*********************************************/
+            prev.emplace(st.name, std::move(cur));
+        }
+        m_prev.swap(prev);
+        m_prev_ts = now;
 
-        if ( m_toterm ) {
-            FILE *term = ((lvl == yal::info || lvl == yal::debug) ? stdout : stderr);
-            if ( !m_prefix.empty() ) {
-                std::fprintf(term, "<%s>%s", m_prefix.c_str(), m_recbuf.c_str());
+        m_text = format(stats, rates, latency);
+        if ( !m_fname.empty() ) {
+            write_file(m_fname, m_text);
+        }
+    }
+
+    static std::string label(const std::string &value) {
+        std::string res;
+        for ( const char c: value ) {
+            if ( c == '\\' || c == '"' ) {
+                res += '\\';
+                res += c;
+            } else if ( c == '\n' ) {
+                res += "\\n";
             } else {
-                std::fprintf(term, "%s", m_recbuf.c_str());
+                res += c;
             }
-            std::fflush(term);
         }
 
-        if ( m_options & create_index_file ) {
-            const std::uint32_t off = static_cast<std::uint32_t>(m_logfile->fpos());
-            const index_record record = {
-                off // start
-                ,1 // dt_off
-                ,static_cast<std::uint8_t>(dtlen) // dt_len
-                ,2 // lvl_off
-                ,1 // lvl_len
-                ,2 // fl_off
-                ,static_cast<std::uint8_t>(fileline_len) // fl_len
-                ,2 // func_off
-                ,static_cast<std::uint8_t>(lfunc_len) // func_len
-                ,3 // data_off
-                ,static_cast<std::uint32_t>(data.size()+1/*for '\n' */) // data_len
-            };
-
-            m_idxfile->write(&record, sizeof(record));
+        return res;
+    }
+    static std::string format(
+         const std::vector<session_stats> &stats
+        ,const std::vector<double> (&rates)[2]
+        ,const std::vector<latency_histogram> &latency)
+    {
+        std::string text;
+        std::vector<std::string> names;
+        for ( const auto &it: stats ) {
+            names.push_back(label(it.name));
         }
 
-        if ( m_proc ) {
-            const auto proc_res = m_proc(m_recbuf.c_str(), reclen);
-            m_logfile->write(proc_res.first, proc_res.second);
-        } else {
-            m_logfile->write(m_recbuf.c_str(), reclen);
+        auto family = [&text](const char *name, const char *type, const char *help) {
+            text += fmt::format("# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+        };
+        auto each = [&](const char *name, const char *type, const char *help, const std::function<double(std::size_t)> &value) {
+            family(name, type, help);
+            for ( std::size_t idx = 0; idx < stats.size(); ++idx ) {
+                text += fmt::format("{}{{session=\"{}\"}} {}\n", name, names[idx], value(idx));
+            }
+        };
+
+        static const std::pair<level, const char*> levels[] = {
+             {yal::error, "error"}
+            ,{yal::warning, "warning"}
+            ,{yal::debug, "debug"}
+            ,{yal::info, "info"}
+        };
+        family("yal_records_total", "counter", "Records written to the session.");
+        for ( std::size_t idx = 0; idx < stats.size(); ++idx ) {
+            for ( const auto &lvl: levels ) {
+                text += fmt::format("yal_records_total{{session=\"{}\",level=\"{}\"}} {}\n", names[idx], lvl.second, stats[idx].records[lvl.first]);
+            }
         }
+        family("yal_bytes_total", "counter", "Bytes of the records written to the session.");
+        for ( std::size_t idx = 0; idx < stats.size(); ++idx ) {
+            for ( const auto &lvl: levels ) {
+                text += fmt::format("yal_bytes_total{{session=\"{}\",level=\"{}\"}} {}\n", names[idx], lvl.second, stats[idx].bytes[lvl.first]);
+            }
+        }
+        each("yal_records_per_second", "gauge", "Records per second since the previous export."
+            ,[&rates](std::size_t idx) { return rates[0][idx]; });
+        each("yal_bytes_per_second", "gauge", "Bytes per second since the previous export."
+            ,[&rates](std::size_t idx) { return rates[1][idx]; });
+        each("yal_queue_depth_bytes", "gauge", "Bytes buffered but not written yet."
+            ,[&stats](std::size_t idx) { return static_cast<double>(stats[idx].queue_depth); });
+
+        family("yal_dropped_records_total", "counter", "Records not written, by reason.");
+        for ( std::size_t idx = 0; idx < stats.size(); ++idx ) {
+            const session_stats &st = stats[idx];
+            const std::pair<const char*, std::uint64_t> reasons[] = {
+                 {"overflow", st.dropped}
+                ,{"shed", st.shed}
+                ,{"budget", st.over_budget}
+            };
+            for ( const auto &it: reasons ) {
+                text += fmt::format("yal_dropped_records_total{{session=\"{}\",reason=\"{}\"}} {}\n", names[idx], it.first, it.second);
+            }
+        }
+        each("yal_blocked_records_total", "counter", "Records whose writers waited for the buffer space."
+            ,[&stats](std::size_t idx) { return static_cast<double>(stats[idx].blocked); });
 
-        if ( m_options & fsync_each_record ) {
-            m_logfile->fsync();
-            if ( m_options & create_index_file ) {
-                m_idxfile->fsync();
+        family("yal_write_latency_seconds", "summary", "Session write latency, the quantiles are since the previous export.");
+        for ( std::size_t idx = 0; idx < stats.size(); ++idx ) {
+            for ( const double q: {0.5, 0.99, 0.999} ) {
+                text += fmt::format("yal_write_latency_seconds{{session=\"{}\",quantile=\"{}\"}} {}\n", names[idx], q, latency[idx].percentile(q) / 1e9);
             }
+            text += fmt::format("yal_write_latency_seconds_sum{{session=\"{}\"}} {}\n", names[idx], stats[idx].latency.sum / 1e9);
+            text += fmt::format("yal_write_latency_seconds_count{{session=\"{}\"}} {}\n", names[idx], stats[idx].latency.total);
         }
 
-        m_writen_bytes += reclen;
-        if ( m_writen_bytes >= m_volume_size ) {
-            m_writen_bytes = 0;
-            m_volume_number += 1;
-            create_volume();
+        each("yal_rotations_total", "counter", "Volume rotations."
+            ,[&stats](std::size_t idx) { return static_cast<double>(stats[idx].rotations); });
+        each("yal_fsyncs_total", "counter", "Volume fsyncs."
+            ,[&stats](std::size_t idx) { return static_cast<double>(stats[idx].fsyncs); });
+        each("yal_write_errors_total", "counter", "Failed volume writes."
+            ,[&stats](std::size_t idx) { return static_cast<double>(stats[idx].errors); });
+
+        return text;
+    }
+    // the readers never see a partially written file. the errors are ignored.
+    static void write_file(const std::string &fname, const std::string &text) {
+        const std::string tmpname = fname + ".tmp";
+        std::FILE *file = create_private(tmpname);
+        if ( !file )
+            return;
+
+        const bool written = std::fwrite(text.data(), 1, text.size(), file) == text.size();
+        const bool ok = (std::fclose(file) == 0) && written;
+        if ( !ok || std::rename(tmpname.c_str(), fname.c_str()) != 0 ) {
+            std::remove(tmpname.c_str());
         }
     }
 
-    const std::string        m_path;
-    const std::string        m_name;
-    const std::size_t        m_volume_size;
-    const std::size_t        m_options;
-    const process_buffer     m_proc;
-    std::size_t              m_shift_after;
-    std::unique_ptr<io_base> m_logfile;
-    std::unique_ptr<io_base> m_idxfile;
-    bool                     m_toterm;
-    std::string              m_prefix;
-    yal::level               m_level;
-    std::string              m_recbuf;
-    std::size_t              m_writen_bytes;
-    std::size_t              m_volume_number;
+    const std::shared_ptr<session_registry> m_sessions;
+    std::string   m_fname;    // empty if the socket is used
+    std::string   m_sockname;
+    const std::size_t m_interval; // in milliseconds
+    int           m_listen;
+    int           m_wakeup[2]; // the pipe stopping the thread
+    std::string   m_text;      // the last metrics, used only by the thread
+    std::map<std::string, previous> m_prev;
+    std::uint64_t m_prev_ts;
+    std::thread   m_thread;
 };
 
+#endif // _WIN32
+
 /***************************************************************************/
 
-session::session(
-     const std::string &path
-    ,const std::string &name
-    ,std::size_t volume_size
-    ,std::size_t opts
-    ,process_buffer proc
-)
-    :pimpl(new impl(path, name, volume_size, opts, std::move(proc)))
-{}
+// reports the records suppressed by the throttled callsites which went quiet,
+// or which never pass a record. the busy ones report them with the passed records.
+// runs every YAL_THROTTLE_SUMMARY_INTERVAL milliseconds, started by the first watched throttle.
+struct throttle_watcher {
+    // never destroyed, because the throttles may be executed during the static destruction
+    static throttle_watcher& instance() {
+        static throttle_watcher *object = new throttle_watcher;
 
-session::~session()
-{}
+        return *object;
+    }
 
-/***************************************************************************/
+    throttle_watcher()
+        :m_mutex()
+        ,m_watched()
+        ,m_thread()
+    {}
 
-const std::string& session::name() const { return pimpl->m_name; }
-std::size_t session::flags() const { return pimpl->m_options; }
-std::size_t session::volume_size() const { return pimpl->m_volume_size; }
-void session::to_term(const bool ok, const std::string &pref) { pimpl->to_term(ok, pref); }
-void session::set_level(const level lvl) { pimpl->m_level = lvl; }
-level session::get_level() const { return pimpl->m_level; }
+    void add(throttle *t, std::weak_ptr<session> log, const callsite &cs) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_watched.emplace_back(new watched{t, std::move(log), &cs, t->passed_records()});
+        if ( !m_thread.joinable() )
+            m_thread = std::thread(&throttle_watcher::run, this);
+    }
 
-void session::write(
-     const char *fileline
-    ,const std::size_t fileline_len
-    ,const char *sfileline
-    ,const std::size_t sfileline_len
-    ,const char *sfunc
-    ,const std::size_t sfunc_len
-    ,const char *func
-    ,const std::size_t func_len
-    ,const std::string &data
-    ,const level lvl)
-{
-    pimpl->write(fileline, fileline_len, sfileline, sfileline_len, sfunc, sfunc_len, func, func_len, data, lvl);
-}
+private:
+    struct watched {
+        throttle *t;
+        std::weak_ptr<session> log; // of the first suppressed record
+        const callsite *cs;
+        std::uint64_t passed; // at the previous check
+    };
+
+    void run() {
+        for ( std::vector<watched*> list; ; list.clear() ) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(YAL_THROTTLE_SUMMARY_INTERVAL));
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                for ( const auto &it: m_watched ) {
+                    list.push_back(it.get());
+                }
+            }
+            for ( auto *it: list ) {
+                report(*it);
+            }
+        }
+    }
+    static void report(watched &w) {
+        // a record passed since the previous check and will report the suppressed ones
+        const std::uint64_t passed = w.t->passed_records();
+        if ( passed != w.passed ) {
+            w.passed = passed;
+            return;
+        }
 
-void session::flush() { pimpl->flush(); }
+        const auto log = w.log.lock();
+        if ( !log || log->get_level() < w.cs->lvl )
+            return;
+        const std::uint64_t suppressed = w.t->take_suppressed();
+        if ( !suppressed )
+            return;
+
+        static const char fileline[] = "yal";
+        static const char func[] = "throttle";
+        try {
+            log->write(
+                 fileline
+                ,sizeof(fileline)-1
+                ,fileline
+                ,sizeof(fileline)-1
+                ,func
+                ,sizeof(func)-1
+                ,func
+                ,sizeof(func)-1
+                ,fmt::format("suppressed {} records of {}:{} {}()", suppressed, w.cs->file, w.cs->line, w.cs->func)
+                ,w.cs->lvl
+            );
+        } catch (...) {
+            // rethrown by the next drain() or flush() of the session
+            log->pimpl->defer_error(std::current_exception());
+        }
+    }
+
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<watched>> m_watched; // never removed, the throttles are static
+    std::thread m_thread;
+};
+
+void throttle::enroll(const std::shared_ptr<session> &log, const callsite &cs) {
+    if ( !m_watched.exchange(true, std::memory_order_relaxed) )
+        throttle_watcher::instance().add(this, log, cs);
+}
 
 /***************************************************************************/
-/***************************************************************************/
+
+// writes the noisiest callsites to the session every 'interval' seconds
+struct callsite_reporter {
+    callsite_reporter(std::weak_ptr<session> log, std::size_t top, std::size_t interval)
+        :m_log(std::move(log))
+        ,m_top(top)
+        ,m_interval(interval)
+        ,m_mutex()
+        ,m_cv()
+        ,m_stop(false)
+        ,m_prev()
+        ,m_thread(&callsite_reporter::run, this)
+    {}
+    ~callsite_reporter() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_one();
+        m_thread.join();
+    }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while ( !m_cv.wait_for(lock, std::chrono::seconds(m_interval), [this]() { return m_stop; }) ) {
+            lock.unlock();
+            report();
+            lock.lock();
+        }
+    }
+
+    struct usage {
+        const callsite *cs;
+        std::uint64_t hits;
+        std::uint64_t bytes;
+    };
+
+    void report() {
+        std::vector<usage> top; // since the previous report
+        std::map<const callsite*, std::pair<std::uint64_t, std::uint64_t>> prev;
+        {
+            auto &registry = callsite_registry::instance();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            for ( const auto *it: registry.callsites ) {
+                const auto cur = std::make_pair(it->hits(), it->bytes());
+                const auto pos = m_prev.find(it);
+                const auto was = pos != m_prev.end() ? pos->second : std::pair<std::uint64_t, std::uint64_t>(0, 0);
+                if ( cur.first != was.first ) {
+                    top.push_back({it, cur.first - was.first, cur.second - was.second});
+                }
+                prev.emplace(it, cur);
+            }
+        }
+        m_prev.swap(prev);
+
+        const std::size_t n = std::min(m_top, top.size());
+        std::partial_sort(
+             top.begin()
+            ,top.begin()+n
+            ,top.end()
+            ,[](const usage &l, const usage &r) { return l.bytes > r.bytes; }
+        );
+
+        const auto log = m_log.lock();
+        if ( !log )
+            return;
+
+        static const char fileline[] = "yal";
+        static const char func[] = "report_callsites";
+        for ( std::size_t idx = 0; idx < n; ++idx ) {
+            const usage &it = top[idx];
+            log->write(
+                 fileline
+                ,sizeof(fileline)-1
+                ,fileline
+                ,sizeof(fileline)-1
+                ,func
+                ,sizeof(func)-1
+                ,func
+                ,sizeof(func)-1
+                ,fmt::format(
+                     "top callsite {}/{} for the last {} sec: {}:{} {}(): {} records, {} bytes"
+                    ,idx+1
+                    ,n
+                    ,m_interval
+                    ,it.cs->file
+                    ,it.cs->line
+                    ,it.cs->func
+                    ,it.hits
+                    ,it.bytes
+                )
+                ,yal::info
+            );
+        }
+    }
+
+    const std::weak_ptr<session> m_log;
+    const std::size_t m_top;
+    const std::size_t m_interval; // in seconds
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_stop;
+    std::map<const callsite*, std::pair<std::uint64_t, std::uint64_t>> m_prev; // hits and bytes
+    std::thread m_thread;
+};
+
 /***************************************************************************/
 
 struct session_manager::impl {
-    using session_weak_ptr = std::weak_ptr<session>;
-    using sessions_map = std::unordered_map<std::string, session_weak_ptr>;
-
-    impl()
+    explicit impl(std::atomic<std::uint8_t> &max_level)
         :mutex()
         ,root_path(".")
-        ,sessions()
+        ,sessions(std::make_shared<session_registry>(max_level))
+#ifndef _WIN32
+        ,exporter()
+#endif // _WIN32
+        ,reporter()
     {}
     ~impl() {
         flush();
@@ -668,29 +3591,71 @@ struct session_manager::impl {
 
     template<typename F>
     void iterate(F func) {
-        for ( auto it = sessions.begin(), end = sessions.end(); it != end; ) {
-            if ( auto session = it->second.lock() ) {
-                func(session);
-                ++it;
-            } else {
-                it = sessions.erase(it);
+        sessions->read(
+            [&func](const session_registry::snapshot &snap) {
+                for ( const auto &it: snap ) {
+                    func(it.ptr);
+                }
             }
-        }
+        );
     }
 
     void flush() {
-        iterate([](yal::session s) { s->flush(); });
+        iterate([](session *s) { s->flush(); });
+    }
+
+    void check_name(const std::string &name) {
+        __YAL_THROW_IF(!name.empty() && name[0] == '/', "session name can't be a full path");
+
+        bool found = false;
+        sessions->read(
+            [&name, &found](const session_registry::snapshot &snap) {
+                auto it = std::lower_bound(snap.begin(), snap.end(), name, session_registry::less);
+                found = it != snap.end() && it->name == name;
+            }
+        );
+        __YAL_THROW_IF(found, "session \""+name+"\" already exists");
+    }
+    yal::session make_session(
+         const std::string &name
+        ,std::size_t volume_size
+        ,std::size_t opts
+        ,process_buffer proc
+        ,io_factory io
+        ,std::size_t volume_number = unknown_volume_number)
+    {
+        yal::session s(
+             new detail::session(root_path, name, volume_size, opts, std::move(proc), volume_number, std::move(io))
+            ,session_deleter{sessions}
+        );
+        s->pimpl->m_registry = sessions.get();
+
+        return s;
+    }
+    void create_session_dir(const std::string &name) {
+        const auto pos = name.find_last_of('/');
+        if ( pos != std::string::npos ) {
+            const std::string path = root_path+"/"+name.substr(0, pos);
+            if ( !exists(path.c_str()) ) {
+                bool ok = create_dir_tree(path.c_str());
+                __YAL_THROW_IF(!ok, "can't create volume path");
+            }
+        }
     }
 
     mutex_t mutex;
     std::string root_path;
-    sessions_map sessions;
+    std::shared_ptr<session_registry> sessions; // shared with the deleters of the sessions
+#ifndef _WIN32
+    std::unique_ptr<metrics_exporter> exporter;
+#endif // _WIN32
+    std::unique_ptr<callsite_reporter> reporter;
 }; // struct impl
 
 /***************************************************************************/
 
 session_manager::session_manager()
-    :pimpl(new impl)
+    :pimpl(new impl(logger::s_max_level))
 {
 #ifndef YAL_DOESNT_USE_TIMEZONE
     // hack for setting the 'timezone' extern var
@@ -723,37 +3688,100 @@ void session_manager::root_path(const std::string &path) {
 }
 
 std::shared_ptr<session>
-session_manager::create(const std::string &name, std::size_t volume_size, std::uint32_t opts, process_buffer proc) {
+session_manager::create(const std::string &name, std::size_t volume_size, std::uint32_t opts, process_buffer proc, io_factory io) {
     guard_t lock(pimpl->mutex);
 
-    __YAL_THROW_IF(!name.empty() && name[0] == '/', "session name can't be a full path");
+    pimpl->check_name(name);
+    pimpl->create_session_dir(name);
 
-    pimpl->iterate(
-        [&name](yal::session s) {
-            __YAL_THROW_IF(s->name() == name, "session \""+name+"\" already exists");
+    yal::session session = pimpl->make_session(name, volume_size, opts, std::move(proc), std::move(io));
+    pimpl->sessions->add(session);
+
+    return session;
+}
+
+std::vector<std::shared_ptr<session>>
+session_manager::create_many(const std::vector<session_params> &params, std::size_t threads) {
+    guard_t lock(pimpl->mutex);
+
+    std::unordered_set<std::string> names;
+    for ( const auto &it: params ) {
+        pimpl->check_name(it.name);
+        __YAL_THROW_IF(!names.insert(it.name).second, "session \""+it.name+"\" already exists");
+    }
+
+    // first try the manifests, and group the rest of the sessions by directory
+    // to read each directory only once.
+    // logpath -> {check_empty, indexes in 'params'}
+    std::unordered_map<std::string, std::pair<bool, std::vector<std::size_t>>> dirs;
+    std::vector<std::size_t> volnums(params.size(), unknown_volume_number);
+    for ( std::size_t idx = 0; idx < params.size(); ++idx ) {
+        const auto &it = params[idx];
+        pimpl->create_session_dir(it.name);
+        if ( it.name == "disable" )
+            continue;
+
+        const bool remove_empty = (it.opts & yal::remove_empty_logs) > 0;
+        if ( it.opts & use_manifest_file ) {
+            const std::string fname = manifest_fname(pimpl->root_path, it.name);
+            if ( recover_from_manifest(fname, remove_empty, &volnums[idx]) )
+                continue;
         }
-    );
 
-    const auto pos = name.find_last_of('/');
-    if ( pos != std::string::npos ) {
-        const std::string path = pimpl->root_path+"/"+name.substr(0, pos);
-        //std::cout << "path:" << path << std::endl;
-        if ( !exists(path.c_str()) ) {
-            bool ok = create_dir_tree(path.c_str());
-            __YAL_THROW_IF(!ok, "can't create volume path");
+        auto &dir = dirs[split_name(pimpl->root_path, it.name).first];
+        dir.first = dir.first || remove_empty;
+        dir.second.push_back(idx);
+    }
+
+    for ( const auto &dir: dirs ) {
+        const scanned_dir scanned = scan_directory(dir.first, dir.second.first);
+        for ( const auto idx: dir.second.second ) {
+            const auto &it = params[idx];
+            const bool remove_empty = (it.opts & yal::remove_empty_logs) > 0;
+            const auto vols = scanned.find(split_name(pimpl->root_path, it.name).second);
+            volnums[idx] = vols != scanned.end() ? finish_volumes(vols->second, remove_empty) : 0;
         }
     }
 
-    yal::session session = std::make_shared<detail::session>(
-         pimpl->root_path
-        ,name
-        ,volume_size
-        ,opts
-        ,std::move(proc)
-    );
-    pimpl->sessions.insert({name, session});
+    std::vector<yal::session> res(params.size());
+    auto construct = [this, &params, &volnums, &res](std::size_t beg, std::size_t step) {
+        for ( std::size_t idx = beg; idx < params.size(); idx += step ) {
+            const auto &it = params[idx];
+            res[idx] = pimpl->make_session(it.name, it.volume_size, it.opts, it.proc, it.io, volnums[idx]);
+        }
+    };
 
-    return session;
+    threads = std::max<std::size_t>(1, std::min(threads, params.size()));
+    if ( threads == 1 ) {
+        construct(0, 1);
+    } else {
+        std::vector<std::exception_ptr> errors(threads);
+        std::vector<std::thread> workers;
+        for ( std::size_t idx = 0; idx < threads; ++idx ) {
+            workers.emplace_back(
+                [idx, threads, &construct, &errors]() {
+                    try {
+                        construct(idx, threads);
+                    } catch (...) {
+                        errors[idx] = std::current_exception();
+                    }
+                }
+            );
+        }
+        for ( auto &it: workers ) {
+            it.join();
+        }
+        for ( const auto &it: errors ) {
+            if ( it )
+                std::rethrow_exception(it);
+        }
+    }
+
+    for ( const auto &it: res ) {
+        pimpl->sessions->add(it);
+    }
+
+    return res;
 }
 
 /***************************************************************************/
@@ -770,12 +3798,40 @@ void session_manager::write(
     ,const std::string &data
     ,const level lvl)
 {
-    guard_t lock(pimpl->mutex);
+    // one timestamp for all the sessions, and the record is assembled once
+    // for all the sessions with the same format options.
+    // (format key, assembled record), at most 16 of them
+    using groups_type = std::vector<std::pair<std::size_t, record_parts>>;
+    static thread_local groups_type groups;
+    static thread_local std::vector<std::string> bufs(16);
+    groups.clear();
+    groups.reserve(16);
+
+    const std::uint64_t ts = dtf::timestamp();
+    auto group = [&](std::size_t opts) -> const record_parts& {
+        const std::size_t key = record_parts::format_key(opts);
+        for ( const auto &it: groups ) {
+            if ( it.first == key )
+                return it.second;
+        }
+
+        groups.emplace_back(
+             key
+            ,record_parts(key, ts, fileline, fileline_len, sfileline, sfileline_len, sfunc, sfunc_len, func, func_len, data, lvl)
+        );
+        record_parts &parts = groups.back().second;
+        std::string &buf = bufs[groups.size()-1];
+        buf.resize(parts.length());
+        parts.format(&buf[0]);
+        parts.assembled = buf.data();
+
+        return parts;
+    };
 
     pimpl->iterate(
-        [fileline, fileline_len, sfileline, sfileline_len, sfunc, sfunc_len, func, func_len, &data, lvl](yal::session s) {
+        [lvl, &group](session *s) {
             if ( s->get_level() >= lvl ) {
-                s->write(fileline, fileline_len, sfileline, sfileline_len, sfunc, sfunc_len, func, func_len, data, lvl);
+                s->pimpl->write(group(s->flags()));
             }
         }
     );
@@ -783,26 +3839,64 @@ void session_manager::write(
 
 std::shared_ptr<session>
 session_manager::get(const std::string &name) const {
-    guard_t lock(pimpl->mutex);
+    std::shared_ptr<session> res;
+    pimpl->sessions->read(
+        [&name, &res](const session_registry::snapshot &snap) {
+            auto it = std::lower_bound(snap.begin(), snap.end(), name, session_registry::less);
+            if ( it != snap.end() && it->name == name )
+                res = it->weak.lock(); // null if the session is being destroyed
+        }
+    );
+
+    return res;
+}
 
-    auto it = pimpl->sessions.find(name);
-    if ( it == pimpl->sessions.end() )
-        return std::shared_ptr<session>();
+/***************************************************************************/
 
-    if ( auto s = it->second.lock() ) {
-        return s;
-    } else {
-        pimpl->sessions.erase(it);
-        return std::shared_ptr<session>();
-    }
+void session_manager::retention(const retention_policy &policy) {
+    housekeeper::instance().global_policy(policy);
+}
+
+retention_policy session_manager::retention() const {
+    return housekeeper::instance().global_policy();
 }
 
 /***************************************************************************/
 
 void session_manager::flush() {
+    pimpl->flush();
+}
+
+/***************************************************************************/
+
+std::vector<session_stats> session_manager::stats() const {
+    std::vector<session_stats> res;
+    pimpl->iterate([&res](session *s) { res.push_back(s->stats()); });
+
+    return res;
+}
+
+void session_manager::export_metrics(const std::string &target, std::size_t interval) {
     guard_t lock(pimpl->mutex);
 
-    pimpl->flush();
+#ifndef _WIN32
+    pimpl->exporter.reset();
+    if ( !target.empty() ) {
+        pimpl->exporter.reset(new metrics_exporter(pimpl->sessions, target, interval));
+    }
+#else
+    (void)interval;
+    __YAL_THROW_IF(!target.empty(), "the metrics exporter isn't supported on this platform");
+#endif // _WIN32
+}
+
+void session_manager::report_callsites(const std::shared_ptr<session> &log, std::size_t top, std::size_t interval) {
+    guard_t lock(pimpl->mutex);
+
+    pimpl->reporter.reset();
+    if ( log && top && interval ) {
+        pimpl->reporter.reset(new callsite_reporter(log, top, interval));
+    }
 }
 
 /***************************************************************************/
@@ -811,6 +3905,8 @@ void session_manager::flush() {
 
 } // ns detail
 
+std::atomic<std::uint8_t> logger::s_max_level(yal::disable);
+
 detail::session_manager* logger::instance() {
     static std::unique_ptr<detail::session_manager> object(new detail::session_manager);
 
@@ -823,9 +3919,14 @@ session logger::create(
      const std::string &name
     ,std::size_t volume_size
     ,std::uint32_t opts
-    ,detail::process_buffer proc)
+    ,detail::process_buffer proc
+    ,detail::io_factory io)
 {
-    return instance()->create(name, volume_size, opts, std::move(proc));
+    return instance()->create(name, volume_size, opts, std::move(proc), std::move(io));
+}
+
+std::vector<yal::session> logger::create_many(const std::vector<session_params> &params, std::size_t threads) {
+    return instance()->create_many(params, threads);
 }
 
 yal::session logger::get(const std::string &name) {
@@ -849,8 +3950,88 @@ void logger::write(
 
 void logger::flush() { instance()->flush(); }
 
+void logger::retention(const retention_policy &policy) { instance()->retention(policy); }
+retention_policy logger::retention() { return instance()->retention(); }
+
+std::vector<session_stats> logger::stats() { return instance()->stats(); }
+void logger::export_metrics(const std::string &target, std::size_t interval) { instance()->export_metrics(target, interval); }
+
 void logger::root_path(const std::string &path) { instance()->root_path(path); }
 
+std::size_t logger::callsites_mode(const callsite_filter &filter, callsite::mode mode) {
+    auto &registry = detail::callsite_registry::instance();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    std::size_t matched = 0;
+    for ( auto *it: registry.callsites ) {
+        if ( filter.match(*it) ) {
+            it->set_mode(mode);
+            ++matched;
+        }
+    }
+
+    // the newer rule for the same callsites replaces the older one,
+    // and resetting all the callsites makes all the rules obsolete
+    auto &rules = registry.rules;
+    rules.erase(
+         std::remove_if(
+             rules.begin()
+            ,rules.end()
+            ,[&filter](const std::pair<callsite_filter, callsite::mode> &it) {
+                return it.first.file == filter.file && it.first.func == filter.func && it.first.line == filter.line;
+            }
+        )
+        ,rules.end()
+    );
+    if ( !(mode == callsite::by_level && filter.file.empty() && filter.func.empty() && !filter.line) ) {
+        rules.emplace_back(filter, mode);
+    } else {
+        rules.clear();
+    }
+
+    return matched;
+}
+
+std::vector<const callsite*> logger::callsites() {
+    auto &registry = detail::callsite_registry::instance();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    return std::vector<const callsite*>(registry.callsites.begin(), registry.callsites.end());
+}
+
+std::vector<const callsite*> logger::top_callsites(std::size_t top) {
+    // the counters keep changing, so they are sorted by a snapshot
+    std::vector<std::pair<std::uint64_t, const callsite*>> sorted;
+    {
+        auto &registry = detail::callsite_registry::instance();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        for ( const auto *it: registry.callsites ) {
+            sorted.emplace_back(it->bytes(), it);
+        }
+    }
+
+    top = std::min(top, sorted.size());
+    std::partial_sort(
+         sorted.begin()
+        ,sorted.begin()+top
+        ,sorted.end()
+        ,[](const std::pair<std::uint64_t, const callsite*> &l, const std::pair<std::uint64_t, const callsite*> &r) {
+            return l.first > r.first;
+        }
+    );
+
+    std::vector<const callsite*> res;
+    for ( std::size_t idx = 0; idx < top; ++idx ) {
+        res.push_back(sorted[idx].second);
+    }
+
+    return res;
+}
+
+void logger::report_callsites(const yal::session &log, std::size_t top, std::size_t interval) {
+    instance()->report_callsites(log, top, interval);
+}
+
 /***************************************************************************/
 /***************************************************************************/
 /***************************************************************************/